@@ -48,6 +48,8 @@
 # define be64toh OSSwapBigToHostInt64
 # define htobe16 OSSwapHostToBigInt16
 # define be16toh OSSwapBigToHostInt16
+# define htobe32 OSSwapHostToBigInt32
+# define be32toh OSSwapBigToHostInt32
 
 #else
 
@@ -60,6 +62,8 @@
 #undef be64toh
 #undef htobe16
 #undef be16toh
+#undef htobe32
+#undef be32toh
 
 /* Use unions rather than casts, to comply with strict aliasing rules. */
 
@@ -119,6 +123,32 @@ inline uint16_t be16toh( uint16_t x ) {
        | ( uint16_t( u.p8[ 1 ] ) );
 }
 
+inline uint32_t htobe32( uint32_t x ) {
+  uint8_t xs[ 4 ] = {
+    ( x >> 24 ) & 0xFF,
+    ( x >> 16 ) & 0xFF,
+    ( x >>  8 ) & 0xFF,
+      x         & 0xFF };
+  union {
+    const uint8_t  *p8;
+    const uint32_t *p32;
+  } u;
+  u.p8 = xs;
+  return *u.p32;
+}
+
+inline uint32_t be32toh( uint32_t x ) {
+  union {
+    const uint8_t  *p8;
+    const uint32_t *p32;
+  } u;
+  u.p32 = &x;
+  return ( uint32_t( u.p8[ 0 ] ) << 24 )
+       | ( uint32_t( u.p8[ 1 ] ) << 16 )
+       | ( uint32_t( u.p8[ 2 ] ) <<  8 )
+       | ( uint32_t( u.p8[ 3 ] ) );
+}
+
 #endif
 
 #endif
@@ -37,6 +37,11 @@
 #include <assert.h>
 #include <sys/resource.h>
 
+#if ( defined(__x86_64__) || defined(__i386__) ) && defined(__GNUC__)
+ #include <cpuid.h>
+ #define HAVE_OCB_AES_NI 1
+#endif
+
 #include "byteorder.h"
 #include "crypto.h"
 #include "base64.h"
@@ -150,25 +155,89 @@ string Base64Key::printable_key( void ) const
   return string( base64 );
 }
 
+/* the entry points of ocb.cc, and of its AES-NI build in ocb_aesni.cc */
+struct Crypto::AEImplementation {
+  const char *name;
+  int (*ctx_sizeof)( void );
+  int (*init)( ae_ctx *, const void *, int, int, int );
+  int (*clear)( ae_ctx * );
+  int (*encrypt)( ae_ctx *, const void *, const void *, int, const void *, int, void *, void *, int );
+  int (*decrypt)( ae_ctx *, const void *, const void *, int, const void *, int, void *, const void *, int );
+};
+
+static const AEImplementation ocb_openssl = {
+  "OpenSSL", ae_ctx_sizeof, ae_init, ae_clear, ae_encrypt, ae_decrypt
+};
+
+#if HAVE_OCB_AES_NI
+extern "C" {
+  int ae_ni_ctx_sizeof( void );
+  int ae_ni_init( ae_ctx *, const void *, int, int, int );
+  int ae_ni_clear( ae_ctx * );
+  int ae_ni_encrypt( ae_ctx *, const void *, const void *, int, const void *, int, void *, void *, int );
+  int ae_ni_decrypt( ae_ctx *, const void *, const void *, int, const void *, int, void *, const void *, int );
+}
+
+static const AEImplementation ocb_aes_ni = {
+  "AES-NI", ae_ni_ctx_sizeof, ae_ni_init, ae_ni_clear, ae_ni_encrypt, ae_ni_decrypt
+};
+
+static bool have_aes_ni( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+  if ( !__get_cpuid( 1, &eax, &ebx, &ecx, &edx ) ) {
+    return false;
+  }
+  return ( ecx & bit_AES ) && ( ecx & bit_SSSE3 );
+}
+#endif
+
+static const AEImplementation *ocb_implementation = NULL;
+
+bool Crypto::ocb_use_aes_ni( bool use )
+{
+#if HAVE_OCB_AES_NI
+  ocb_implementation = ( use && have_aes_ni() ) ? &ocb_aes_ni : &ocb_openssl;
+  return ocb_implementation == &ocb_aes_ni;
+#else
+  (void)use;
+  ocb_implementation = &ocb_openssl;
+  return false;
+#endif
+}
+
+static const AEImplementation *default_implementation( void )
+{
+  if ( !ocb_implementation ) {
+    ocb_use_aes_ni( true );
+  }
+  return ocb_implementation;
+}
+
 Session::Session( Base64Key s_key )
-  : key( s_key ), ctx_buf( ae_ctx_sizeof() ),
+  : key( s_key ), ae( default_implementation() ), ctx_buf( ae->ctx_sizeof() ),
     ctx( (ae_ctx *)ctx_buf.data() ), blocks_encrypted( 0 ),
     plaintext_buffer( RECEIVE_MTU ),
     ciphertext_buffer( RECEIVE_MTU ),
     nonce_buffer( Nonce::NONCE_LEN )
 {
-  if ( AE_SUCCESS != ae_init( ctx, key.data(), 16, 12, 16 ) ) {
+  if ( AE_SUCCESS != ae->init( ctx, key.data(), 16, 12, 16 ) ) {
     throw CryptoException( "Could not initialize AES-OCB context." );
   }
 }
 
 Session::~Session()
 {
-  if ( ae_clear( ctx ) != AE_SUCCESS ) {
+  if ( ae->clear( ctx ) != AE_SUCCESS ) {
     throw CryptoException( "Could not clear AES-OCB context." );
   }
 }
 
+const char *Session::implementation( void ) const
+{
+  return ae->name;
+}
+
 Nonce::Nonce( uint64_t val )
 {
   uint64_t val_net = htobe64( val );
@@ -205,17 +274,100 @@ Message::Message( Nonce s_nonce, string s_text )
     text( s_text )
 {}
 
+void Session::count_blocks( size_t len )
+{
+  blocks_encrypted += len >> 4;
+  if ( len & 0xF ) {
+    blocks_encrypted++;
+  }
+
+  /* "Both the privacy and the authenticity properties of OCB degrade as
+      per s^2 / 2^128, where s is the total number of blocks that the
+      adversary acquires.... In order to ensure that s^2 / 2^128 remains
+      small, a given key should be used to encrypt at most 2^48 blocks (2^55
+      bits or 4 petabytes)"
+
+     -- http://tools.ietf.org/html/draft-krovetz-ocb-03
+
+     We deem it unlikely that a legitimate user will send 4 PB through a
+     single session. If it happens, we throw a fatal exception rather
+     than risk the confidentiality of the session. */
+  if ( blocks_encrypted >> 47 ) {
+    throw CryptoException( "Encrypted 2^47 blocks.", true );
+  }
+}
+
 string Session::encrypt( Message plaintext )
 {
-  return plaintext.nonce.cc_str() + plaintext.text;
+  const size_t pt_len = plaintext.text.size();
+  const int ciphertext_len = pt_len + TAG_LEN;
+
+  assert( (size_t)ciphertext_len <= ciphertext_buffer.len() );
+  assert( pt_len <= plaintext_buffer.len() );
+
+  memcpy( plaintext_buffer.data(), plaintext.text.data(), pt_len );
+  memcpy( nonce_buffer.data(), plaintext.nonce.data(), Nonce::NONCE_LEN );
+
+  if ( ciphertext_len != ae->encrypt( ctx,                                     /* ctx */
+				      nonce_buffer.data(),                     /* nonce */
+				      plaintext_buffer.data(),                 /* pt */
+				      pt_len,                                  /* pt_len */
+				      NULL,                                    /* ad */
+				      0,                                       /* ad_len */
+				      ciphertext_buffer.data(),                /* ct */
+				      NULL,                                    /* tag */
+				      AE_FINALIZE ) ) {                        /* final */
+    throw CryptoException( "ae_encrypt() returned error." );
+  }
+
+  count_blocks( pt_len );
+
+  return plaintext.nonce.cc_str() + string( ciphertext_buffer.data(), ciphertext_len );
+}
+
+size_t Session::encrypt( Nonce nonce, char *wire, size_t text_len )
+{
+  char *text = wire + 8;
+  const int ciphertext_len = text_len + TAG_LEN;
+
+  memcpy( wire, nonce.data() + 4, 8 );
+  memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
+
+  /* the SSE code needs 16-byte alignment */
+  const bool aligned = !( (uintptr_t)text & 0xF );
+  if ( !aligned ) {
+    assert( text_len <= plaintext_buffer.len() );
+    assert( (size_t)ciphertext_len <= ciphertext_buffer.len() );
+    memcpy( plaintext_buffer.data(), text, text_len );
+  }
+
+  if ( ciphertext_len != ae->encrypt( ctx, nonce_buffer.data(),
+				      aligned ? text : plaintext_buffer.data(), text_len,
+				      NULL, 0,
+				      aligned ? text : ciphertext_buffer.data(), NULL,
+				      AE_FINALIZE ) ) {
+    throw CryptoException( "ae_encrypt() returned error." );
+  }
+
+  if ( !aligned ) {
+    memcpy( text, ciphertext_buffer.data(), ciphertext_len );
+  }
+
+  count_blocks( text_len );
+
+  return 8 + ciphertext_len;
 }
 
 Message Session::decrypt( string ciphertext )
 {
+  if ( ciphertext.size() < size_t( 8 + TAG_LEN ) ) {
+    throw CryptoException( "Ciphertext must contain nonce and tag." );
+  }
+
   char *str = (char *)ciphertext.data();
 
   int body_len = ciphertext.size() - 8;
-  int pt_len = body_len;
+  int pt_len = body_len - TAG_LEN;
 
   assert( (size_t)body_len <= ciphertext_buffer.len() );
   assert( (size_t)pt_len <= plaintext_buffer.len() );
@@ -224,7 +376,54 @@ Message Session::decrypt( string ciphertext )
   memcpy( ciphertext_buffer.data(), str + 8, body_len );
   memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
 
-  return Message( nonce, string( ciphertext_buffer.data(), body_len ) );
+  if ( pt_len != ae->decrypt( ctx,                                     /* ctx */
+			      nonce_buffer.data(),                     /* nonce */
+			      ciphertext_buffer.data(),                /* ct */
+			      body_len,                                /* ct_len */
+			      NULL,                                    /* ad */
+			      0,                                       /* ad_len */
+			      plaintext_buffer.data(),                 /* pt */
+			      NULL,                                    /* tag */
+			      AE_FINALIZE ) ) {                        /* final */
+    throw CryptoException( "Packet failed integrity check." );
+  }
+
+  return Message( nonce, string( plaintext_buffer.data(), pt_len ) );
+}
+
+Slice Session::decrypt( char *wire, size_t wire_len, Nonce & nonce )
+{
+  if ( wire_len < size_t( 8 + TAG_LEN ) ) {
+    throw CryptoException( "Ciphertext must contain nonce and tag." );
+  }
+
+  char *text = wire + 8;
+  const int body_len = wire_len - 8;
+  const int pt_len = body_len - TAG_LEN;
+
+  nonce = Nonce( wire, 8 );
+  memcpy( nonce_buffer.data(), nonce.data(), Nonce::NONCE_LEN );
+
+  /* the SSE code needs 16-byte alignment */
+  const bool aligned = !( (uintptr_t)text & 0xF );
+  if ( !aligned ) {
+    assert( (size_t)body_len <= ciphertext_buffer.len() );
+    memcpy( ciphertext_buffer.data(), text, body_len );
+  }
+
+  if ( pt_len != ae->decrypt( ctx, nonce_buffer.data(),
+			      aligned ? text : ciphertext_buffer.data(), body_len,
+			      NULL, 0,
+			      aligned ? text : plaintext_buffer.data(), NULL,
+			      AE_FINALIZE ) ) {
+    throw CryptoException( "Packet failed integrity check." );
+  }
+
+  if ( !aligned ) {
+    memcpy( text, plaintext_buffer.data(), pt_len );
+  }
+
+  return Slice( text, pt_len );
 }
 
 static rlim_t saved_core_rlimit;
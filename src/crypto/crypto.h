@@ -34,6 +34,7 @@
 #define CRYPTO_HPP
 
 #include "ae.h"
+#include "slice.h"
 #include <string>
 #include <string.h>
 #include <stdint.h>
@@ -112,9 +113,18 @@ namespace Crypto {
     Message( Nonce s_nonce, string s_text );
   };
   
+  /* one build of the AES-OCB code */
+  struct AEImplementation;
+
+  /* Whether Sessions made from now on use the AES-NI build of AES-OCB,
+     if the processor has AES-NI and SSSE3 (the default), or the
+     OpenSSL one. Returns whether AES-NI will be used. */
+  bool ocb_use_aes_ni( bool use );
+
   class Session {
   private:
     Base64Key key;
+    const AEImplementation *ae;
     AlignedBuffer ctx_buf;
     ae_ctx *ctx;
     uint64_t blocks_encrypted;
@@ -122,15 +132,32 @@ namespace Crypto {
     AlignedBuffer plaintext_buffer;
     AlignedBuffer ciphertext_buffer;
     AlignedBuffer nonce_buffer;
+
+    void count_blocks( size_t len );
     
   public:
     static const int RECEIVE_MTU = 2048;
+    static const int TAG_LEN = 16;
 
     Session( Base64Key s_key );
     ~Session();
     
     string encrypt( Message plaintext );
+
+    /* In place: the 8 bytes at wire get the nonce, the text_len bytes
+       after them are encrypted, and the TAG_LEN after those get the
+       tag. Returns the length on the wire. Fastest with the text
+       16-byte aligned (wire + 8); otherwise it is copied. */
+    size_t encrypt( Nonce nonce, char *wire, size_t text_len );
     Message decrypt( string ciphertext );
+
+    /* In place: the nonce is read from the 8 bytes at wire, and the
+       text after them checked and decrypted where it lies. Returns the
+       text. Alignment as for encrypt(). */
+    Slice decrypt( char *wire, size_t wire_len, Nonce & nonce );
+
+    /* which build of AES-OCB this Session uses */
+    const char *implementation( void ) const;
     
     Session( const Session & );
     Session & operator=( const Session & );
@@ -48,9 +48,17 @@
 
 /* This implementation has built-in support for multiple AES APIs. Set any
 /  one of the following to non-zero to specify which to use.               */
+/* Mosh: ocb_aesni.cc builds this file again, with AES-NI and under other
+/  names, and crypto.cc picks one of the two at run time.                  */
+#ifndef OCB_AES_NI_BUILD
 #define USE_OPENSSL_AES      1  /* http://openssl.org                      */
 #define USE_REFERENCE_AES    0  /* Internet search: rijndael-alg-fst.c     */
 #define USE_AES_NI           0  /* Uses compiler's intrinsics              */
+#else
+#define USE_OPENSSL_AES      0
+#define USE_REFERENCE_AES    0
+#define USE_AES_NI           1
+#endif
 
 /* During encryption and decryption, various "L values" are required.
 /  The L values can be precomputed during initialization (requiring extra
@@ -0,0 +1,24 @@
+/* OCB with AES-NI and SSSE3, for processors that have them. This is
+   ocb.cc compiled a second time for those instructions, with its
+   entry points renamed ae_ni_*; crypto.cc checks CPUID before using
+   it, so the rest of the program still runs anywhere. */
+
+#if ( defined(__x86_64__) || defined(__i386__) ) && defined(__GNUC__)
+
+#pragma GCC target("sse2,ssse3,aes")
+
+#define OCB_AES_NI_BUILD 1
+
+#define _ae_ctx _ae_ni_ctx
+#define ae_allocate ae_ni_allocate
+#define ae_free ae_ni_free
+#define ae_clear ae_ni_clear
+#define ae_ctx_sizeof ae_ni_ctx_sizeof
+#define ae_init ae_ni_init
+#define ae_encrypt ae_ni_encrypt
+#define ae_decrypt ae_ni_decrypt
+#define infoString ae_ni_infoString
+
+#include "ocb.cc"
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "processforecaster.hh"
+#include "modelfile.hh"
+#include "receiver.hh"
+#include "sproutmath.pb.h"
+
+/* Convert a protobuf model (as written by SPROUT_MODEL_OUT) to the
+   flat format that Receiver maps directly. The protobuf format does
+   not record its parameters, so the Receiver's defaults are stored.
+
+   Usage: convertmodel INPUT OUTPUT [--float] */
+
+template <class Scalar>
+static double max_difference( const std::vector< ProcessForecastInterval > & original,
+			      const std::vector< BasicProcessForecastInterval< Scalar > > & converted )
+{
+  double ret = 0;
+  for ( unsigned int i = 0; i < original.size(); i++ ) {
+    const Matrix & a = original[ i ].count_probability();
+    const BasicMatrix< Scalar > & b = converted.at( i ).count_probability();
+    for ( unsigned int row = 0; row < a.rows(); row++ ) {
+      for ( unsigned int col = 0; col < a.cols(); col++ ) {
+	ret = std::max( ret, fabs( a( row, col ) - double( b( row, col ) ) ) );
+      }
+    }
+  }
+  return ret;
+}
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 3 || argc > 4 || ( argc == 4 && strcmp( argv[ 3 ], "--float" ) ) ) {
+    fprintf( stderr, "Usage: %s INPUT OUTPUT [--float]\n", argv[ 0 ] );
+    return 1;
+  }
+
+  const bool single_precision = ( argc == 4 );
+
+  int fd = open( argv[ 1 ], O_RDONLY );
+  if ( fd < 0 ) {
+    perror( argv[ 1 ] );
+    return 1;
+  }
+
+  Sprout::SproutModel model;
+  if ( !model.ParseFromFileDescriptor( fd ) ) {
+    fprintf( stderr, "Could not parse %s.\n", argv[ 1 ] );
+    return 1;
+  }
+
+  if ( close( fd ) < 0 ) {
+    perror( "close" );
+    return 1;
+  }
+
+  std::vector< ProcessForecastInterval > intervals;
+  for ( int i = 0; i < model.intervals_size(); i++ ) {
+    intervals.push_back( ProcessForecastInterval( model.intervals( i ) ) );
+  }
+
+  ModelFile::write( argv[ 2 ], intervals, ReceiverConfig().model, ReceiverConfig().quantile,
+		    single_precision );
+
+  /* read it back through the same checks as Receiver */
+  std::shared_ptr< const ModelFile > check( ModelFile::get( argv[ 2 ] ) );
+  const double max_error = check->single_precision()
+    ? max_difference( intervals, check->single_intervals() )
+    : max_difference( intervals, check->intervals() );
+
+  fprintf( stderr, "Wrote %d intervals to %s (%s, max error %g).\n",
+	   model.intervals_size(), argv[ 2 ],
+	   single_precision ? "float32" : "float64", max_error );
+
+  return 0;
+}
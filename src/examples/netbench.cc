@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "crypto.h"
+#include "network.h"
+#include "select.h"
+
+using namespace std;
+using namespace Network;
+
+/* Cipher speed, then loopback send and receive throughput.
+
+   Usage: netbench [packets]
+
+   Each build of AES-OCB the processor can run encrypts and decrypts
+   datagrams in place, with the text 16-byte aligned as Connection
+   keeps it or unaligned (copied through the Session's buffers), after
+   checking it agrees with the OpenSSL build.
+
+   A client sends bursts of datagrams to a server, which drains each
+   burst with recv() (one recvfrom() per datagram, payload copied out),
+   recv_slice() (payload left in the receive buffer) or recv_many().
+   Only the draining is timed, and its heap allocations counted; it
+   includes decryption and the Sprout receiver, as in use.
+
+   Then the client sends the bursts with send() (one sendto() per
+   datagram) or send_many(), with and without GSO, and only the sending
+   is timed, including encryption. */
+
+static uint64_t allocations = 0;
+
+void *operator new( size_t size )
+{
+  allocations++;
+  void *ret = malloc( size );
+  if ( ret == NULL ) {
+    throw std::bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete( void *ptr ) noexcept
+{
+  free( ptr );
+}
+
+static double now( void )
+{
+  struct timespec tp;
+  if ( clock_gettime( CLOCK_MONOTONIC, &tp ) < 0 ) {
+    perror( "clock_gettime" );
+    exit( 1 );
+  }
+  return tp.tv_sec + tp.tv_nsec / 1.e9;
+}
+
+/* one datagram's worth of room, with the text after the nonce at an
+   offset from a 16-byte boundary */
+static char *wire_at( AlignedBuffer & buf, const size_t offset )
+{
+  return buf.data() + 16 - 8 + offset;
+}
+
+static void check_ciphers( void )
+{
+  Base64Key key;
+  AlignedBuffer buf( Session::RECEIVE_MTU + 32 );
+  const size_t len = 1000;
+
+  ocb_use_aes_ni( true );
+  Session fast( key );
+  ocb_use_aes_ni( false );
+  Session reference( key );
+
+  char *wire = wire_at( buf, 0 );
+  memset( wire + 8, 'x', len );
+  const string ciphertext( wire, fast.encrypt( Nonce( 17 ), wire, len ) );
+
+  if ( ciphertext != reference.encrypt( Message( Nonce( 17 ), string( len, 'x' ) ) ) ) {
+    fprintf( stderr, "%s and %s ciphertexts differ\n", fast.implementation(), reference.implementation() );
+    exit( 1 );
+  }
+
+  string tampered( ciphertext );
+  tampered[ 100 ] ^= 1;
+  try {
+    reference.decrypt( tampered );
+    fprintf( stderr, "Tampered packet passed integrity check\n" );
+    exit( 1 );
+  } catch ( const CryptoException & ) {}
+}
+
+static void bench_ciphers( const int packets, const int sizes[], const unsigned int num_sizes )
+{
+  Base64Key key;
+  AlignedBuffer buf( Session::RECEIVE_MTU + 32 );
+
+  for ( int use_aes_ni = 1; use_aes_ni >= 0; use_aes_ni-- ) {
+    if ( ocb_use_aes_ni( use_aes_ni ) != bool( use_aes_ni ) ) {
+      continue; /* not on this processor */
+    }
+    Session session( key );
+
+    for ( unsigned int s = 0; s < num_sizes; s++ ) {
+      for ( size_t offset = 0; offset < 2; offset++ ) {
+	char *wire = wire_at( buf, offset );
+	memset( wire + 8, 'x', sizes[ s ] );
+
+	double encrypting = 0, decrypting = 0;
+	for ( int i = 0; i < packets; i++ ) {
+	  Nonce nonce( i );
+	  const double start = now();
+	  const size_t wire_len = session.encrypt( nonce, wire, sizes[ s ] );
+	  const double middle = now();
+	  session.decrypt( wire, wire_len, nonce );
+	  decrypting += now() - middle;
+	  encrypting += middle - start;
+	}
+
+	const double bits = 8. * sizes[ s ] * packets;
+	printf( "%4d-byte payloads, %-7s %-9s encrypt %7.3f us/packet %6.2f Gbps, decrypt %7.3f us/packet %6.2f Gbps\n",
+		sizes[ s ], session.implementation(), offset ? "unaligned" : "aligned",
+		1.e6 * encrypting / packets, bits / encrypting / 1.e9,
+		1.e6 * decrypting / packets, bits / decrypting / 1.e9 );
+      }
+    }
+  }
+
+  /* back to the default for the connections */
+  ocb_use_aes_ni( true );
+}
+
+int main( int argc, char *argv[] )
+{
+  const int packets = ( argc > 1 ) ? atoi( argv[ 1 ] ) : 100000;
+  const int burst = 32; /* well inside the default socket buffer */
+  const int sizes[] = { 100, 1400 };
+
+  if ( packets <= 0 ) {
+    fprintf( stderr, "Usage: %s [packets]\n", argv[ 0 ] );
+    return 1;
+  }
+
+  check_ciphers();
+  bench_ciphers( packets, sizes, sizeof( sizes ) / sizeof( sizes[ 0 ] ) );
+
+  Connection server( NULL, NULL );
+  Connection client( server.get_key().c_str(), "127.0.0.1", server.port() );
+
+  Select &sel = Select::get_instance();
+  sel.add_fd( server.fd() );
+
+  vector< Slice > payloads;
+
+  for ( unsigned int s = 0; s < sizeof( sizes ) / sizeof( sizes[ 0 ] ); s++ ) {
+    const string payload( sizes[ s ], 'x' );
+
+    for ( int mode = 0; mode < 3; mode++ ) {
+      static const char *names[] = { "recv:", "recv_slice:", "recv_many:" };
+      int sent = 0, received = 0;
+      double elapsed = 0;
+      uint64_t allocated = 0;
+
+      while ( sent < packets ) {
+	for ( int i = 0; i < burst; i++ ) {
+	  client.send( payload );
+	}
+	sent += burst;
+
+	const double start = now();
+	const uint64_t allocations_before = allocations;
+	while ( received < sent ) {
+	  /* give up on a burst after 100 ms, in case any was dropped */
+	  if ( sel.select( 100 ) <= 0 ) {
+	    break;
+	  }
+
+	  if ( mode == 2 ) {
+	    server.recv_many( payloads );
+	    received += payloads.size();
+	  } else if ( mode == 1 ) {
+	    server.recv_slice();
+	    received++;
+	  } else {
+	    server.recv();
+	    received++;
+	  }
+	}
+	allocated += allocations - allocations_before;
+	elapsed += now() - start;
+      }
+
+      printf( "%4d-byte payloads, %-11s %9.3f us/packet %10.0f packets/s %5.2f allocations/packet (%d of %d received)\n",
+	      sizes[ s ], names[ mode ],
+	      1.e6 * elapsed / received, received / elapsed, double( allocated ) / received, received, sent );
+    }
+  }
+
+  vector< pair< string, uint16_t > > burst_payloads;
+
+  for ( unsigned int s = 0; s < sizeof( sizes ) / sizeof( sizes[ 0 ] ); s++ ) {
+    burst_payloads.assign( burst, make_pair( string( sizes[ s ], 'x' ), 0 ) );
+
+    for ( int mode = 0; mode < 3; mode++ ) {
+      static const char *names[] = { "send:", "send_many:", "+ GSO:" };
+      int sent = 0, received = 0;
+      double elapsed = 0;
+
+      client.set_gso( mode == 2 );
+
+      while ( sent < packets ) {
+	const double start = now();
+	if ( mode == 0 ) {
+	  for ( int i = 0; i < burst; i++ ) {
+	    client.send( burst_payloads[ i ].first );
+	  }
+	} else {
+	  client.send_many( burst_payloads );
+	}
+	elapsed += now() - start;
+	sent += burst;
+
+	while ( received < sent && sel.select( 100 ) > 0 ) {
+	  server.recv_many( payloads );
+	  received += payloads.size();
+	}
+      }
+
+      printf( "%4d-byte payloads, %-11s %9.3f us/packet %10.0f packets/s (%d of %d received)%s\n",
+	      sizes[ s ], names[ mode ],
+	      1.e6 * elapsed / sent, sent / elapsed, received, sent,
+	      ( mode == 2 && !client.get_gso() ) ? " [GSO refused]" : "" );
+    }
+  }
+
+  return 0;
+}
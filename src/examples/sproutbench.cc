@@ -0,0 +1,1077 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <thread>
+#include <queue>
+#include <functional>
+#include <boost/math/distributions/normal.hpp>
+#include <boost/math/distributions/poisson.hpp>
+
+#include "process.hh"
+#include "processforecaster.hh"
+#include "poissonkernel.hh"
+#include "transitionkernel.hh"
+#include "receiver.hh"
+#include "receiverbatch.hh"
+#include "modelfile.hh"
+#include "sproutmath.pb.h"
+#include "timestamp.h"
+
+/* Microbenchmarks for the Sprout inference and forecasting code.
+
+   Usage: sproutbench [section ...]
+
+   With no arguments, every section is run. */
+
+static const double MAX_ARRIVAL_RATE = 1000;
+static const double BROWNIAN_MOTION_RATE = 200;
+static const double OUTAGE_ESCAPE_RATE = 1;
+static const int NUM_BINS = 256;
+static const double TICK_TIME = 0.02;
+
+static double now( void )
+{
+  struct timespec tp;
+  if ( clock_gettime( CLOCK_MONOTONIC, &tp ) < 0 ) {
+    perror( "clock_gettime" );
+    exit( 1 );
+  }
+  return tp.tv_sec + tp.tv_nsec / 1.e9;
+}
+
+static void report( const char *what, const double seconds, const int iterations )
+{
+  printf( "%-40s %12.3f us/iteration (%d iterations)\n",
+	  what, 1.e6 * seconds / iterations, iterations );
+}
+
+static void bench_evolve( void )
+{
+  Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+
+  /* warm up, including any cached tables */
+  process.evolve( TICK_TIME );
+  process.normalize();
+
+  const int iterations = 2000;
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    process.evolve( TICK_TIME );
+  }
+  report( "Process::evolve", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    process.evolve( TICK_TIME );
+    process.observe( TICK_TIME, i % 7 );
+    process.normalize();
+  }
+  report( "evolve + observe + normalize", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    process.tick( TICK_TIME, i % 7 );
+    process.normalize();
+  }
+  report( "fused tick + normalize", now() - start, iterations );
+}
+
+static void bench_visitors( void )
+{
+  Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  process.tick( TICK_TIME, 3 );
+  process.normalize();
+
+  SampledFunction pmf( process.pmf() );
+  const SampledFunction weights( process.pmf() );
+  const int iterations = 20000;
+  double total = 0;
+
+  /* the old interface: every bin an indirect call */
+  auto mean = [&] ( const double midpoint, const double & value, const unsigned int ) { total += midpoint * value; };
+  const std::function< void( const double, const double &, const unsigned int ) > mean_function( mean );
+
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.for_each( mean_function );
+  }
+  report( "mean rate, std::function visitor", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.for_each( mean );
+  }
+  report( "mean rate, template visitor", now() - start, iterations );
+
+  const double *w = weights.data();
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.for_each( [&] ( const double, double & value, const unsigned int index ) { value += 1e-3 * w[ index ]; } );
+  }
+  report( "axpy, template visitor", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.axpy( 1e-3, w );
+  }
+  report( "SampledFunction::axpy", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    total += pmf.dot( w );
+    pmf.scale( 0.5 );
+  }
+  report( "SampledFunction::dot + scale", now() - start, iterations );
+
+  /* table construction walks the bins through for_each and for_range */
+  const SampledFunction geometry( NUM_BINS, MAX_ARRIVAL_RATE, 0 );
+  const double stddev = BROWNIAN_MOTION_RATE * sqrt( TICK_TIME );
+  const boost::math::normal diffdist( 0, stddev );
+  const int builds = 20;
+
+  start = now();
+  for ( int i = 0; i < builds; i++ ) {
+    TransitionKernel kernel( geometry, stddev, 0.02, [&] ( const double x ) { return boost::math::cdf( diffdist, x ); } );
+    total += kernel.stddev();
+  }
+  report( "TransitionKernel construction", now() - start, builds );
+
+  /* a whole Receiver tick: a few packets in, advance, forecast */
+  Receiver receiver;
+  receiver.warp_to( 0 );
+  const int tick = receiver.get_tick_length();
+  uint64_t time = 0, seq = 0;
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    for ( int j = 0; j < 1 + i % 5; j++ ) {
+      receiver.recv( seq, 0, 0, 1400 );
+      seq += 1450;
+    }
+    time += tick;
+    receiver.advance_to( time + 1 );
+    total += receiver.forecast().counts( 0 );
+  }
+  report( "Receiver tick (recv, advance, forecast)", now() - start, iterations );
+
+  if ( total < 0 ) {
+    printf( "impossible\n" );
+  }
+}
+
+static void bench_bins( void )
+{
+  /* 128, 256 and 512 bins use the fixed-size loops; the others don't */
+  const int sizes[] = { 128, 200, 256, 300, 512 };
+
+  for ( unsigned int i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); i++ ) {
+    Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, sizes[ i ] );
+    process.evolve( TICK_TIME );
+
+    const int iterations = 2000;
+    double start = now();
+    for ( int j = 0; j < iterations; j++ ) {
+      process.observe( TICK_TIME, j % 7 );
+      process.normalize();
+    }
+
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "observe + normalize, %d bins", sizes[ i ] );
+    report( what, now() - start, iterations );
+  }
+
+  /* a Receiver configured away from the defaults */
+  ReceiverConfig config;
+  config.model.num_bins = 512;
+  config.model.tick_length = 10;
+  config.quantile = 0.1;
+
+  double start = now();
+  Receiver receiver( config );
+  report( "Receiver( 512 bins, 10 ms ticks )", now() - start, 1 );
+}
+
+static void bench_poisson( void )
+{
+  Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+
+  const int iterations = 2000;
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    process.observe( TICK_TIME, i % 30 );
+    process.normalize();
+  }
+  report( "Process::observe + normalize", now() - start, iterations );
+
+  double total = 0;
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    total += process.count_probability( TICK_TIME, i % 30 );
+  }
+  report( "Process::count_probability", now() - start, iterations );
+
+  /* accuracy and speed of the log-space kernel against boost::math */
+  SampledFunction geometry( NUM_BINS, MAX_ARRIVAL_RATE, 0 );
+  PoissonKernel kernel( geometry, TICK_TIME );
+  std::vector< double > out( kernel.size() );
+
+  double max_relative_error = 0;
+  for ( int counts = 0; counts < 200; counts++ ) {
+    kernel.evaluate( counts, out.data() );
+    geometry.for_each( [&] ( const double midpoint, const double &, const unsigned int index ) {
+	const double rate = midpoint * TICK_TIME;
+	const double reference = ( rate == 0 ) ? ( counts == 0 )
+	  : boost::math::pdf( boost::math::poisson( rate ), counts );
+	if ( reference > 1e-300 ) {
+	  max_relative_error = std::max( max_relative_error, fabs( out[ index ] - reference ) / reference );
+	}
+      } );
+  }
+  printf( "%-40s %12.3g\n", "max relative error vs boost", max_relative_error );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    kernel.evaluate( 100 + i % 30, out.data() );
+    total += out[ i % out.size() ];
+  }
+  report( "PoissonKernel::evaluate (all bins)", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    geometry.for_each( [&] ( const double midpoint, const double &, const unsigned int index ) {
+	/* boost rejects a zero mean */
+	out[ index ] = boost::math::pdf( boost::math::poisson( midpoint * TICK_TIME + 1e-9 ), 100 + i % 30 );
+      } );
+    total += out[ i % out.size() ];
+  }
+  report( "boost::math::pdf (all bins)", now() - start, iterations );
+
+  if ( total < 0 ) {
+    printf( "impossible\n" );
+  }
+}
+
+static void bench_underflow( void )
+{
+  Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+
+  /* a long outage, then a burst far beyond the maximum rate, with
+     no forecast (and so no normalize) in between */
+  for ( int i = 0; i < 500; i++ ) {
+    process.evolve( TICK_TIME );
+    process.observe( TICK_TIME, 0 );
+  }
+
+  const int burst = 20;
+  double start = now();
+  for ( int i = 0; i < burst; i++ ) {
+    process.evolve( TICK_TIME );
+    process.observe( TICK_TIME, 150 );
+  }
+  report( "evolve + observe, 150-packet ticks", now() - start, burst );
+
+  process.normalize();
+
+  double total = 0;
+  bool finite = true;
+  process.pmf().for_each( [&] ( const double, const double & value, const unsigned int ) {
+      finite = finite && std::isfinite( value );
+      total += value;
+    } );
+
+  printf( "%-40s %12s\n", "pmf after burst", ( finite && fabs( total - 1 ) < 1e-9 ) ? "normalized" : "BROKEN" );
+  printf( "%-40s %12.1f\n", "median rate after burst", process.lower_quantile( 0.5 ) );
+}
+
+static void bench_stall( void )
+{
+  Process base( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  for ( int i = 0; i < 100; i++ ) {
+    base.tick( TICK_TIME, 3 );
+  }
+  base.normalize();
+
+  /* five seconds with nothing received */
+  const unsigned int ticks = 250;
+  const int iterations = 200;
+
+  /* builds the dense powers, and keeps them cached while the copies come and go */
+  Process warm( base );
+  warm.fast_forward( TICK_TIME, ticks, true );
+
+  Process stepped( base ), skipped( base );
+
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    stepped = base;
+    for ( unsigned int j = 0; j < ticks; j++ ) {
+      stepped.tick( TICK_TIME, 0 );
+    }
+    stepped.normalize();
+  }
+  report( "250 idle ticks, one at a time", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    skipped = base;
+    skipped.fast_forward( TICK_TIME, ticks, true );
+    skipped.normalize();
+  }
+  report( "250 idle ticks, fast-forwarded", now() - start, iterations );
+
+  double max_error = 0;
+  for ( unsigned int i = 0; i < stepped.pmf().size(); i++ ) {
+    max_error = std::max( max_error, fabs( stepped.pmf().data()[ i ] - skipped.pmf().data()[ i ] ) );
+  }
+  printf( "%-40s %12.3g\n", "max difference in pmf", max_error );
+  printf( "%-40s %12.1f %12.1f\n", "median rate (stepped, fast-forwarded)",
+	  stepped.lower_quantile( 0.5 ), skipped.lower_quantile( 0.5 ) );
+}
+
+static void bench_forecast( void )
+{
+  Receiver receiver;
+  receiver.warp_to( 0 );
+
+  const int tick = receiver.get_tick_length();
+  const int iterations = 10000;
+  uint64_t time = 0, seq = 0;
+  double advance = 0, forecast = 0;
+  unsigned int total = 0;
+
+  for ( int i = 0; i < iterations; i++ ) {
+    /* a few packets per tick, varying so the forecast keeps moving */
+    for ( int j = 0; j < 1 + (i / 50) % 8; j++ ) {
+      receiver.recv( seq, 0, 0, 1400 );
+      seq += 1450;
+    }
+
+    time += tick;
+    double start = now();
+    receiver.advance_to( time + 1 );
+    advance += now() - start;
+
+    start = now();
+    Sprout::DeliveryForecast fc( receiver.forecast() );
+    forecast += now() - start;
+
+    total += fc.counts( fc.counts_size() - 1 );
+  }
+
+  report( "Receiver::advance_to (one tick)", advance, iterations );
+  report( "Receiver::forecast", forecast, iterations );
+  printf( "%-40s %12u\n", "checksum of forecasts", total );
+}
+
+static void bench_quantiles( void )
+{
+  Process process( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  for ( int i = 0; i < 50; i++ ) {
+    process.tick( TICK_TIME, 4 + i % 5 );
+  }
+  process.normalize();
+
+  const std::vector< double > levels = { 0.05, 0.5, 0.95 };
+  const int iterations = 20000;
+  std::vector< double > rates;
+  double total = 0;
+
+  /* the old linear scan, as the reference */
+  auto scan = [&] ( const double x ) {
+    double sum = 0.0;
+    for ( unsigned int i = 0; i < process.pmf().size(); i++ ) {
+      sum += process.pmf().data()[ i ];
+      if ( sum >= x ) {
+	return i;
+      }
+    }
+    return process.pmf().size() - 1;
+  };
+
+  unsigned int mismatches = 0;
+  for ( int i = 0; i <= 1000; i++ ) {
+    const unsigned int bin = scan( i / 1000.0 );
+    const double expected = bin ? bin * process.pmf().bin_width() + process.pmf().offset() : 0;
+    mismatches += ( process.lower_quantile( i / 1000.0 ) != expected );
+  }
+  printf( "%-40s %12u\n", "rate quantiles differing from scan", mismatches );
+
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    for ( unsigned int j = 0; j < levels.size(); j++ ) {
+      total += scan( levels[ j ] );
+    }
+  }
+  report( "3 rate quantiles, linear scans", now() - start, iterations );
+
+  SampledFunction pmf( process.pmf() );
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.data(); /* as after a tick: the sums are rebuilt */
+    pmf.lower_quantiles( levels, rates );
+    total += rates[ 0 ];
+  }
+  report( "3 rate quantiles, sums rebuilt", now() - start, iterations );
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    pmf.lower_quantiles( levels, rates );
+    total += rates[ 0 ];
+  }
+  report( "3 rate quantiles, sums cached", now() - start, iterations );
+
+  /* count quantiles for every interval of a forecast */
+  const std::shared_ptr< const ForecastModel > model( ForecastModel::get( ReceiverConfig().model ) );
+  std::vector< unsigned int > one, all;
+  std::vector< std::vector< unsigned int > > separate( levels.size() );
+
+  start = now();
+  for ( int i = 0; i < iterations / 10; i++ ) {
+    for ( unsigned int j = 0; j < levels.size(); j++ ) {
+      model->lower_quantiles( process.pmf().data(), levels[ j ], FORECAST_DOUBLE, separate[ j ] );
+    }
+  }
+  report( "3 forecast quantiles, separately", now() - start, iterations / 10 );
+
+  start = now();
+  for ( int i = 0; i < iterations / 10; i++ ) {
+    model->lower_quantiles( process.pmf().data(), levels.data(), levels.size(), FORECAST_DOUBLE, all );
+  }
+  report( "3 forecast quantiles, one pass", now() - start, iterations / 10 );
+
+  start = now();
+  for ( int i = 0; i < iterations / 10; i++ ) {
+    model->lower_quantiles( process.pmf().data(), levels[ 0 ], FORECAST_DOUBLE, one );
+  }
+  report( "5% forecast quantile alone", now() - start, iterations / 10 );
+
+  mismatches = 0;
+  for ( unsigned int i = 0; i < separate[ 0 ].size(); i++ ) {
+    for ( unsigned int j = 0; j < levels.size(); j++ ) {
+      mismatches += ( separate[ j ][ i ] != all[ i * levels.size() + j ] );
+    }
+  }
+  printf( "%-40s %12u\n", "one-pass quantiles differing", mismatches );
+
+  if ( total < 0 ) {
+    printf( "impossible\n" );
+  }
+}
+
+static void bench_levels( void )
+{
+  /* the same traffic to a Receiver forecasting one quantile, and one
+     also offering two more to the sender */
+  ReceiverConfig config;
+  config.extra_quantiles = { 0.5, 0.95 };
+  Receiver single, multiple( config );
+  single.warp_to( 0 );
+  multiple.warp_to( 0 );
+
+  const int tick = single.get_tick_length();
+  const int iterations = 5000;
+  uint64_t time = 0, seq = 0;
+  double single_time = 0, multiple_time = 0;
+  unsigned long single_bytes = 0, multiple_bytes = 0;
+  unsigned int mismatches = 0;
+  std::vector< int > counts;
+
+  for ( int i = 0; i < iterations; i++ ) {
+    for ( int j = 0; j < 1 + (i / 50) % 8; j++ ) {
+      single.recv( seq, 0, 0, 1400 );
+      multiple.recv( seq, 0, 0, 1400 );
+      seq += 1450;
+    }
+
+    time += tick;
+    single.advance_to( time + 1 );
+    multiple.advance_to( time + 1 );
+
+    double start = now();
+    const Sprout::DeliveryForecast a( single.forecast() );
+    single_time += now() - start;
+
+    start = now();
+    const Sprout::DeliveryForecast b( multiple.forecast() );
+    multiple_time += now() - start;
+
+    single_bytes += a.ByteSizeLong();
+    multiple_bytes += b.ByteSizeLong();
+
+    /* the sender's default level must see the same counts as before */
+    ForecastLevels::select( b, 0.05, counts );
+    for ( int j = 0; j < a.counts_size(); j++ ) {
+      mismatches += ( counts[ j ] != int( a.counts( j ) ) );
+    }
+
+    /* and the others must be in order */
+    std::vector< int > median, high;
+    ForecastLevels::select( b, 0.5, median );
+    ForecastLevels::select( b, 0.95, high );
+    for ( int j = 0; j < a.counts_size(); j++ ) {
+      mismatches += !( counts[ j ] <= median[ j ] && median[ j ] <= high[ j ] );
+    }
+  }
+
+  report( "Receiver::forecast, 1 level", single_time, iterations );
+  report( "Receiver::forecast, 3 levels", multiple_time, iterations );
+  printf( "%-40s %12.1f %12.1f\n", "mean bytes on the wire (1, 3 levels)",
+	  double( single_bytes ) / iterations, double( multiple_bytes ) / iterations );
+  printf( "%-40s %12u\n", "mismatched or out-of-order counts", mismatches );
+}
+
+/* the RecvQueue this replaced: a heap, copied and drained to count */
+class HeapRecvQueue
+{
+private:
+  class PacketLen {
+  public:
+    uint64_t seq;
+    int len;
+    bool operator()( const PacketLen & a, const PacketLen & b ) const { return a.seq > b.seq; }
+    PacketLen( const uint64_t s_seq, const int s_len ) : seq( s_seq ), len( s_len ) {}
+    PacketLen( void ) : seq( -1 ), len( 0 ) {}
+  };
+
+  std::priority_queue< PacketLen, std::deque< PacketLen >, PacketLen > received_sequence_numbers;
+  uint64_t throwaway_before;
+
+public:
+  HeapRecvQueue() : received_sequence_numbers(), throwaway_before( 0 ) {}
+
+  void recv( const uint64_t seq, const uint16_t throwaway_window, const int len )
+  {
+    received_sequence_numbers.push( PacketLen( seq, len ) );
+    throwaway_before = std::max( throwaway_before, seq - throwaway_window );
+  }
+
+  uint64_t packet_count( void )
+  {
+    while ( !received_sequence_numbers.empty() && received_sequence_numbers.top().seq < throwaway_before ) {
+      received_sequence_numbers.pop();
+    }
+
+    std::priority_queue< PacketLen, std::deque< PacketLen >, PacketLen > copy( received_sequence_numbers );
+    int buffer_sum = 0;
+    while ( !copy.empty() ) {
+      buffer_sum += copy.top().len;
+      copy.pop();
+    }
+    return throwaway_before + buffer_sum;
+  }
+};
+
+static void bench_reorder( void )
+{
+  /* every packet counted, as when each one ends a flight */
+  const struct { int len; unsigned int displacement; } cases[] = {
+    { 1400, 0 }, { 1400, 32 }, { 100, 0 }, { 100, 256 } };
+  const int packets = 100000;
+
+  for ( unsigned int c = 0; c < sizeof( cases ) / sizeof( cases[ 0 ] ); c++ ) {
+    /* in order, then shuffled within blocks of the displacement */
+    std::vector< uint64_t > order( packets );
+    for ( int i = 0; i < packets; i++ ) {
+      order[ i ] = uint64_t( i ) * cases[ c ].len;
+    }
+    unsigned int seed = 1;
+    if ( cases[ c ].displacement ) {
+      for ( int i = 0; i < packets; i += cases[ c ].displacement ) {
+	for ( int j = std::min( packets, i + int( cases[ c ].displacement ) ) - 1; j > i; j-- ) {
+	  std::swap( order[ j ], order[ i + rand_r( &seed ) % ( j - i + 1 ) ] );
+	}
+      }
+    }
+
+    /* as far back as the sender allows (it never reaches below zero) */
+    auto window = [&] ( const int i ) { return uint16_t( std::min( uint64_t( 65535 ), order[ i ] ) ); };
+
+    HeapRecvQueue heap;
+    Receiver::RecvQueue queue;
+    uint64_t heap_total = 0, queue_total = 0;
+
+    double start = now();
+    for ( int i = 0; i < packets; i++ ) {
+      heap.recv( order[ i ], window( i ), cases[ c ].len );
+      heap_total += heap.packet_count();
+    }
+    const double heap_time = now() - start;
+
+    start = now();
+    for ( int i = 0; i < packets; i++ ) {
+      queue.recv( order[ i ], window( i ), cases[ c ].len );
+      queue_total += queue.packet_count();
+    }
+    const double queue_time = now() - start;
+
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "%d-byte packets, reordered by %u, heap", cases[ c ].len, cases[ c ].displacement );
+    report( what, heap_time, packets );
+    snprintf( what, sizeof( what ), "%d-byte packets, reordered by %u, deque", cases[ c ].len, cases[ c ].displacement );
+    report( what, queue_time, packets );
+
+    if ( heap_total != queue_total ) {
+      fprintf( stderr, "Mismatch in byte counts (%lu, %lu)\n", (unsigned long)heap_total, (unsigned long)queue_total );
+      exit( 1 );
+    }
+  }
+}
+
+static void bench_clock( void )
+{
+  const int iterations = 1000000;
+  uint64_t total = 0;
+
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    struct timespec tp;
+    clock_gettime( CLOCK_MONOTONIC, &tp );
+    total += tp.tv_nsec;
+  }
+  report( "clock_gettime( CLOCK_MONOTONIC )", now() - start, iterations );
+
+  timestamp_use_tsc( false );
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    freeze_timestamp();
+  }
+  report( "freeze_timestamp, system clock", now() - start, iterations );
+
+  if ( timestamp_use_tsc( true ) ) {
+    /* let the calibration finish */
+    freeze_timestamp();
+    usleep( 150000 );
+    freeze_timestamp();
+
+    start = now();
+    for ( int i = 0; i < iterations; i++ ) {
+      freeze_timestamp();
+    }
+    report( "freeze_timestamp, TSC", now() - start, iterations );
+
+    /* drift from the system clock over a second and a half */
+    int64_t max_error = 0;
+    for ( int i = 0; i < 300; i++ ) {
+      usleep( 5000 );
+      freeze_timestamp();
+      const uint64_t tsc_time = frozen_timestamp_us();
+      timestamp_use_tsc( false );
+      freeze_timestamp();
+      const int64_t error = int64_t( frozen_timestamp_us() ) - int64_t( tsc_time );
+      timestamp_use_tsc( true );
+      max_error = std::max( max_error, error < 0 ? -error : error );
+    }
+    printf( "%-40s %12ld us\n", "TSC vs system clock, worst", long( max_error ) );
+  } else {
+    printf( "%-40s %12s\n", "freeze_timestamp, TSC", "unavailable" );
+  }
+
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    total += frozen_timestamp_us();
+  }
+  report( "frozen_timestamp_us", now() - start, iterations );
+
+  timestamp_track_staleness( true );
+  start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    total += frozen_timestamp_us();
+  }
+  report( "frozen_timestamp_us, tracking staleness", now() - start, iterations );
+
+  /* a receive loop: freeze after each wakeup, then a burst of packets,
+     each fed to a Receiver and forecast, reading the clock as the
+     connection code does */
+  for ( int limit = 0; limit <= 10; limit += 10 ) {
+    Receiver receiver;
+    freeze_timestamp();
+    receiver.warp_to_us( frozen_timestamp_us() );
+    timestamp_limit_staleness( limit );
+    timestamp_reset_staleness();
+
+    uint64_t seq = 0;
+    for ( int wakeup = 0; wakeup < 2000; wakeup++ ) {
+      freeze_timestamp();
+      for ( int packet = 0; packet < 64; packet++ ) {
+	receiver.advance_to_us( frozen_timestamp_us() );
+	receiver.recv( seq, 0, 0, 1400 );
+	seq += 1450;
+	total += receiver.forecast().counts_size() + frozen_timestamp_us();
+      }
+    }
+
+    const TimestampStaleness & stale = timestamp_staleness();
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "staleness, limit %d us (mean, max)", limit );
+    printf( "%-40s %9.1f us %9lu us\n", what, double( stale.total_us ) / stale.uses, (unsigned long)stale.max_us );
+    snprintf( what, sizeof( what ), "refrozen uses, limit %d us", limit );
+    printf( "%-40s %12lu of %lu\n", what, (unsigned long)stale.refreezes, (unsigned long)stale.uses );
+  }
+
+  timestamp_limit_staleness( 0 );
+  timestamp_track_staleness( false );
+
+  if ( total == 0 ) {
+    printf( "impossible\n" );
+  }
+}
+
+/* Delivery opportunities, in ms, one per line (the cellsim trace
+   format) from SPROUTBENCH_TRACE, or else a synthetic link whose rate
+   wanders between outages and bursts. */
+static std::vector< uint64_t > load_trace( void )
+{
+  std::vector< uint64_t > trace;
+
+  const char *filename = getenv( "SPROUTBENCH_TRACE" );
+  if ( filename ) {
+    FILE *f = fopen( filename, "r" );
+    if ( !f ) {
+      perror( "fopen" );
+      exit( 1 );
+    }
+    unsigned long ms;
+    while ( fscanf( f, "%lu\n", &ms ) == 1 ) {
+      trace.push_back( ms );
+    }
+    fclose( f );
+    return trace;
+  }
+
+  unsigned int seed = 1;
+  double rate = 200; /* packets per second */
+  for ( uint64_t ms = 0; ms < 120000; ms++ ) {
+    if ( ms % 100 == 0 ) {
+      rate = std::max( 0.0, std::min( 1000.0, rate + ( int( rand_r( &seed ) % 201 ) - 100 ) ) );
+    }
+    if ( rand_r( &seed ) < rate / 1000 * RAND_MAX ) {
+      trace.push_back( ms );
+    }
+  }
+  return trace;
+}
+
+template <class Scalar>
+static unsigned long table_bytes( const std::vector< BasicProcessForecastInterval< Scalar > > & intervals )
+{
+  unsigned long ret = 0;
+  for ( auto it = intervals.begin(); it != intervals.end(); it++ ) {
+    ret += it->count_probability().rows() * it->count_probability().stride() * sizeof( Scalar );
+  }
+  return ret;
+}
+
+/* the same trace forecast from narrower tables, against double */
+static void bench_precision( void )
+{
+  const std::vector< uint64_t > trace( load_trace() );
+  const ForecastPrecision precisions[] = { FORECAST_DOUBLE, FORECAST_SINGLE, FORECAST_FIXED16 };
+  const char *names[] = { "double", "float", "fixed16" };
+  const int num_precisions = 3;
+
+  std::vector< Receiver > receivers;
+  for ( int p = 0; p < num_precisions; p++ ) {
+    ReceiverConfig config;
+    config.precision = precisions[ p ];
+    receivers.push_back( Receiver( config ) );
+    receivers.back().warp_to( 0 );
+  }
+
+  const int tick = receivers.front().get_tick_length();
+  double seconds[ num_precisions ] = { 0 };
+  unsigned int differing[ num_precisions ] = { 0 }, worst[ num_precisions ] = { 0 };
+  unsigned int forecasts = 0, values = 0;
+  uint64_t seq = 0;
+
+  auto opportunity = trace.begin();
+  for ( uint64_t time = tick; opportunity != trace.end(); time += tick ) {
+    for ( ; opportunity != trace.end() && *opportunity < time; opportunity++ ) {
+      for ( int p = 0; p < num_precisions; p++ ) {
+	receivers[ p ].recv( seq, 0, 0, 1400 );
+      }
+      seq += 1400;
+    }
+
+    Sprout::DeliveryForecast fc[ num_precisions ];
+    for ( int p = 0; p < num_precisions; p++ ) {
+      receivers[ p ].advance_to( time + 1 );
+      const double start = now();
+      fc[ p ] = receivers[ p ].forecast();
+      seconds[ p ] += now() - start;
+    }
+
+    forecasts++;
+    values += fc[ 0 ].counts_size();
+    for ( int p = 1; p < num_precisions; p++ ) {
+      for ( int i = 0; i < fc[ 0 ].counts_size(); i++ ) {
+	const unsigned int error = abs( int( fc[ p ].counts( i ) ) - int( fc[ 0 ].counts( i ) ) );
+	differing[ p ] += ( error > 0 );
+	worst[ p ] = std::max( worst[ p ], error );
+      }
+    }
+  }
+
+  /* budget: off by at most one packet, in at most 1% of forecast values */
+  bool within_budget = true;
+  for ( int p = 0; p < num_precisions; p++ ) {
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "Receiver::forecast, %s tables", names[ p ] );
+    report( what, seconds[ p ], forecasts );
+    if ( p > 0 ) {
+      const bool ok = ( worst[ p ] <= 1 ) && ( differing[ p ] * 100 <= values );
+      printf( "%-40s %12u of %u differ, by at most %u (%s)\n", "", differing[ p ], values, worst[ p ],
+	      ok ? "within budget" : "OVER BUDGET" );
+      within_budget = within_budget && ok;
+    }
+  }
+
+  const std::shared_ptr< const ForecastModel > model( ForecastModel::get( ReceiverConfig().model ) );
+  printf( "%-40s %12lu %12lu %12lu\n", "table bytes (double, float, fixed16)",
+	  table_bytes( model->intervals() ), table_bytes( model->single_intervals() ),
+	  table_bytes( model->fixed16_intervals() ) );
+
+  if ( !within_budget ) {
+    exit( 1 );
+  }
+}
+
+/* per Receiver: a few packets a tick, varying across Receivers and over time */
+static int batch_packets( const unsigned int receiver, const int tick )
+{
+  return ( receiver + tick / 5 ) % 4;
+}
+
+static void bench_batch( void )
+{
+  const int ticks = 50;
+  const unsigned int sizes[] = { 16, 256, 2048 };
+
+  for ( unsigned int s = 0; s < sizeof( sizes ) / sizeof( sizes[ 0 ] ); s++ ) {
+    const unsigned int n = sizes[ s ];
+    std::vector< Receiver > receivers( n );
+    ReceiverBatch batch( 0 );
+    std::vector< Sprout::DeliveryForecast > batch_forecasts;
+    std::vector< uint64_t > seqs( n, 0 );
+
+    for ( unsigned int r = 0; r < n; r++ ) {
+      receivers[ r ].warp_to( 0 );
+      batch.add();
+    }
+
+    const int tick = batch.get_tick_length();
+    double separate = 0, together = 0;
+    unsigned int separate_total = 0, batch_total = 0;
+    bool identical = true;
+
+    for ( int i = 0; i < ticks; i++ ) {
+      const uint64_t time = uint64_t( i + 1 ) * tick + 1;
+
+      double start = now();
+      for ( unsigned int r = 0; r < n; r++ ) {
+	for ( int p = 0; p < batch_packets( r, i ); p++ ) {
+	  receivers[ r ].recv( seqs[ r ] + 1450 * p, 0, 0, 1400 );
+	}
+	receivers[ r ].advance_to( time );
+      }
+      std::vector< Sprout::DeliveryForecast > forecasts( n );
+      for ( unsigned int r = 0; r < n; r++ ) {
+	forecasts[ r ] = receivers[ r ].forecast();
+      }
+      separate += now() - start;
+
+      start = now();
+      for ( unsigned int r = 0; r < n; r++ ) {
+	for ( int p = 0; p < batch_packets( r, i ); p++ ) {
+	  batch.recv( r, seqs[ r ] + 1450 * p, 0, 0, 1400 );
+	}
+      }
+      batch.advance_to( time );
+      batch.forecast_all( batch_forecasts );
+      together += now() - start;
+
+      for ( unsigned int r = 0; r < n; r++ ) {
+	seqs[ r ] += 1450 * batch_packets( r, i );
+	separate_total += forecasts[ r ].counts( forecasts[ r ].counts_size() - 1 );
+	batch_total += batch_forecasts[ r ].counts( batch_forecasts[ r ].counts_size() - 1 );
+	identical = identical && ( forecasts[ r ].SerializeAsString() == batch_forecasts[ r ].SerializeAsString() );
+      }
+    }
+
+    /* one tick and one forecast per Receiver per tick length */
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "%u Receivers, separately", n );
+    report( what, separate, ticks * n );
+    printf( "%-40s %12.0f receivers/core\n", "", .001 * tick * ticks * n / separate );
+    snprintf( what, sizeof( what ), "%u Receivers, batched", n );
+    report( what, together, ticks * n );
+    printf( "%-40s %12.0f receivers/core\n", "", .001 * tick * ticks * n / together );
+    printf( "%-40s %12s (checksums %u, %u)\n", "forecasts", identical ? "identical" : "DIFFER",
+	    separate_total, batch_total );
+  }
+}
+
+static long peak_rss_kb( void )
+{
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) < 0 ) {
+    perror( "getrusage" );
+    exit( 1 );
+  }
+  return usage.ru_maxrss;
+}
+
+static void bench_components( void )
+{
+  Process example( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  example.evolve( TICK_TIME );
+  example.normalize();
+
+  const long rss_before = peak_rss_kb();
+
+  const int iterations = 5;
+  double start = now();
+  for ( int i = 0; i < iterations; i++ ) {
+    std::vector< Process > components( ProcessForecastTick::make_components( example ) );
+  }
+  report( "ProcessForecastTick::make_components", now() - start, iterations );
+
+  printf( "%-40s %12ld kB\n", "peak RSS growth", peak_rss_kb() - rss_before );
+}
+
+static void bench_model( void )
+{
+  /* the Receiver's model, written in both formats */
+  Process example( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  std::vector< ProcessForecastInterval > intervals;
+  Sprout::SproutModel model;
+  for ( int i = 0; i < 8; i++ ) {
+    intervals.push_back( ProcessForecastInterval( TICK_TIME, example, 30, i + 1 ) );
+    *model.add_intervals() = intervals.back().to_protobuf();
+  }
+
+  char protobuf_name[] = "/tmp/sproutbench-model-XXXXXX";
+  int fd = mkstemp( protobuf_name );
+  if ( fd < 0 || !model.SerializeToFileDescriptor( fd ) || close( fd ) < 0 ) {
+    perror( "protobuf model" );
+    exit( 1 );
+  }
+
+  char flat_name[] = "/tmp/sproutbench-flat-XXXXXX";
+  fd = mkstemp( flat_name );
+  if ( fd < 0 || close( fd ) < 0 ) {
+    perror( "mkstemp" );
+    exit( 1 );
+  }
+  ModelFile::write( flat_name, intervals, ReceiverConfig().model, ReceiverConfig().quantile );
+
+  /* the first Receiver loads the model; the rest share it */
+  const char *names[] = { protobuf_name, flat_name };
+  const char *formats[] = { "protobuf", "flat" };
+  const int iterations = 20;
+
+  for ( int format = 0; format < 2; format++ ) {
+    std::vector< Receiver > receivers;
+    setenv( "SPROUT_MODEL_IN", names[ format ], 1 );
+
+    char what[ 64 ];
+    double start = now();
+    receivers.push_back( Receiver() );
+    snprintf( what, sizeof( what ), "first Receiver() from %s model", formats[ format ] );
+    report( what, now() - start, 1 );
+
+    start = now();
+    for ( int i = 0; i < iterations; i++ ) {
+      receivers.push_back( Receiver() );
+    }
+    snprintf( what, sizeof( what ), "later Receiver()s, %s model", formats[ format ] );
+    report( what, now() - start, iterations );
+  }
+
+  unsetenv( "SPROUT_MODEL_IN" );
+  unlink( protobuf_name );
+  unlink( flat_name );
+}
+
+static void bench_build( void )
+{
+  Process example( MAX_ARRIVAL_RATE, BROWNIAN_MOTION_RATE, OUTAGE_ESCAPE_RATE, NUM_BINS );
+  const unsigned int num_ticks = 8;
+
+  /* one interval at a time, each from scratch */
+  double start = now();
+  std::vector< ProcessForecastInterval > separate;
+  for ( unsigned int i = 0; i < num_ticks; i++ ) {
+    separate.push_back( ProcessForecastInterval( TICK_TIME, example, 30, i + 1 ) );
+  }
+  report( "8 intervals, separately", now() - start, 1 );
+
+  const unsigned int cores = std::max( 1u, std::thread::hardware_concurrency() );
+  for ( unsigned int threads = 1; threads <= cores; threads *= 2 ) {
+    start = now();
+    std::vector< ProcessForecastInterval > horizons( ProcessForecastInterval::make_horizons( TICK_TIME, example, 30,
+											   num_ticks, threads ) );
+    char what[ 64 ];
+    snprintf( what, sizeof( what ), "8 intervals in one pass, %u thread%s", threads, threads > 1 ? "s" : "" );
+    report( what, now() - start, 1 );
+
+    /* must match the separate construction exactly */
+    for ( unsigned int i = 0; i < num_ticks; i++ ) {
+      const Matrix & a = separate[ i ].count_probability();
+      const Matrix & b = horizons[ i ].count_probability();
+      for ( unsigned int row = 0; row < a.rows(); row++ ) {
+	if ( memcmp( a.row( row ), b.row( row ), a.cols() * sizeof( double ) ) ) {
+	  fprintf( stderr, "Mismatch in interval %u, row %u\n", i, row );
+	  exit( 1 );
+	}
+      }
+    }
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*run)( void );
+} sections[] = {
+  { "evolve", bench_evolve },
+  { "visitors", bench_visitors },
+  { "poisson", bench_poisson },
+  { "bins", bench_bins },
+  { "underflow", bench_underflow },
+  { "stall", bench_stall },
+  { "forecast", bench_forecast },
+  { "quantiles", bench_quantiles },
+  { "levels", bench_levels },
+  { "reorder", bench_reorder },
+  { "clock", bench_clock },
+  { "batch", bench_batch },
+  { "precision", bench_precision },
+  { "components", bench_components },
+  { "model", bench_model },
+  { "build", bench_build },
+};
+
+int main( int argc, char *argv[] )
+{
+  const int num_sections = sizeof( sections ) / sizeof( sections[ 0 ] );
+
+  for ( int i = 0; i < num_sections; i++ ) {
+    bool selected = ( argc < 2 );
+    for ( int j = 1; j < argc; j++ ) {
+      if ( !strcmp( argv[ j ], sections[ i ].name ) ) {
+	selected = true;
+      }
+    }
+
+    if ( selected ) {
+      printf( "[%s]\n", sections[ i ].name );
+      sections[ i ].run();
+    }
+  }
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <string>
 #include <assert.h>
 #include <list>
+#include <vector>
+#include <sys/resource.h>
 
 #include "sproutconn.h"
 #include "select.h"
@@ -9,6 +11,17 @@
 using namespace std;
 using namespace Network;
 
+static double cpu_seconds( void )
+{
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) < 0 ) {
+    perror( "getrusage" );
+    exit( 1 );
+  }
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+    + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1.e6;
+}
+
 int main( int argc, char *argv[] )
 {
   char *ip;
@@ -18,23 +31,28 @@ int main( int argc, char *argv[] )
 
   bool server = true;
 
-  if ( argc > 2 ) {
-    /* client */
+  if ( argc > 3 ) {
+    /* client, with the key the server printed */
 
     server = false;
 
     ip = argv[ 1 ];
     port = atoi( argv[ 2 ] );
 
-    net = new Network::SproutConnection( "4h/Td1v//4jkYhqhLGgegw", ip, port );
+    net = new Network::SproutConnection( argv[ 3 ], ip, port );
+  } else if ( argc == 3 ) {
+    fprintf( stderr, "Usage: %s [PORT] | IP PORT KEY\n", argv[ 0 ] );
+    exit( 1 );
   } else if ( argc == 2 ) {
     net = new Network::SproutConnection( NULL, argv[ 1 ] );
 
     printf( "Listening on port: %d\n", net->port() );
+    printf( "Key: %s\n", net->get_key().c_str() );
   } else {
     net = new Network::SproutConnection( NULL, NULL );
 
     printf( "Listening on port: %d\n", net->port() );
+    printf( "Key: %s\n", net->get_key().c_str() );
   }
 
   Select &sel = Select::get_instance();
@@ -65,12 +83,21 @@ int main( int argc, char *argv[] )
 
   fprintf( stderr, "Looping...\n" );  
 
+  vector< Slice > packets;
+  vector< pair< string, uint16_t > > burst;
+
+  /* once a second, packets each way and CPU time per packet */
+  uint64_t next_report = timestamp() + 1000;
+  uint64_t sent_count = 0, received_count = 0;
+  double cpu_at_report = cpu_seconds();
+
   /* loop */
   while ( 1 ) {
     int bytes_to_send = net->window_size();
 
     /* actually send, maybe */
     if ( ( bytes_to_send > 0 ) || ( time_of_next_transmission <= timestamp() ) ) {
+      burst.clear();
       do {
 	int this_packet_size = std::min( 1440, bytes_to_send );
 	bytes_to_send -= this_packet_size;
@@ -83,30 +110,46 @@ int main( int argc, char *argv[] )
 	  time_to_next = fallback_interval;
 	}
 
-	net->send( garbage, time_to_next );
+	burst.push_back( make_pair( garbage, time_to_next ) );
       } while ( bytes_to_send > 0 );
 
+      net->send_many( burst );
+      sent_count += burst.size();
+
       time_of_next_transmission = std::max( timestamp() + fallback_interval,
 					    time_of_next_transmission );
     }
 
-    /* wait */
-    int wait_time = time_of_next_transmission - timestamp();
+    /* wait, to the microsecond */
+    int64_t wait_time = int64_t( 1000 * time_of_next_transmission ) - int64_t( timestamp_us() );
     if ( wait_time < 0 ) {
       wait_time = 0;
-    } else if ( wait_time > 10 ) {
-      wait_time = 10;
+    } else if ( wait_time > 10000 ) {
+      wait_time = 10000;
     }
 
-    int active_fds = sel.select( wait_time );
+    int active_fds = sel.select_us( wait_time );
     if ( active_fds < 0 ) {
       perror( "select" );
       exit( 1 );
     }
 
-    /* receive */
+    /* receive everything waiting */
     if ( sel.read( net->fd() ) ) {
-      string packet( net->recv() );
+      net->recv_many( packets );
+      received_count += packets.size();
+    }
+
+    if ( timestamp() >= next_report ) {
+      const double cpu = cpu_seconds();
+      const double per_packet = ( sent_count + received_count )
+	? 1.e6 * ( cpu - cpu_at_report ) / ( sent_count + received_count ) : 0;
+      fprintf( stderr, "%llu packets/s sent, %llu packets/s received, %.2f us CPU per packet\n",
+	       (unsigned long long)sent_count, (unsigned long long)received_count, per_packet );
+
+      next_report += 1000;
+      sent_count = received_count = 0;
+      cpu_at_report = cpu;
     }
   }
 }
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "receiver.hh"
+#include "forecastmodel.hh"
+#include "modelfile.hh"
+
+/* Offline model compiler.
+
+   Builds the forecast model for each combination of the given
+   parameters and writes it in the flat format (or as protobuf), ready
+   for SPROUT_MODEL_IN. Each table option takes a comma-separated list;
+   with more than one combination, OUTPUT is used as a prefix and the
+   parameters are appended to each file name. The quantile is only
+   recorded in the header: the tables serve any quantile, so it is not
+   part of the sweep. */
+
+static void usage( const char *argv0 )
+{
+  const ModelParameters defaults( ReceiverConfig().model );
+
+  fprintf( stderr, "Usage: %s [options] OUTPUT\n\n", argv0 );
+  fprintf( stderr, "  -t, --tick-length=MS              (default %d)\n", defaults.tick_length );
+  fprintf( stderr, "  -b, --bins=N                      (default %d)\n", defaults.num_bins );
+  fprintf( stderr, "  -r, --max-rate=PKTS_PER_SEC       (default %g)\n", defaults.max_arrival_rate );
+  fprintf( stderr, "  -m, --brownian-rate=RATE          (default %g)\n", defaults.brownian_motion_rate );
+  fprintf( stderr, "  -o, --outage-escape-rate=RATE     (default %g)\n", defaults.outage_escape_rate );
+  fprintf( stderr, "  -a, --arrivals-per-tick=N         (default %d)\n", defaults.max_arrivals_per_tick );
+  fprintf( stderr, "  -n, --horizons=TICKS              (default %d)\n", defaults.num_ticks );
+  fprintf( stderr, "  -q, --quantile=Q                  recorded in the header (default %g)\n", ReceiverConfig().quantile );
+  fprintf( stderr, "  -f, --float                       store float32 tables\n" );
+  fprintf( stderr, "  -p, --protobuf                    write the protobuf format\n" );
+  fprintf( stderr, "  -j, --jobs=N                      models built at once (default: one per core)\n\n" );
+  fprintf( stderr, "Each of -t to -n may be a comma-separated list; every combination is built.\n" );
+}
+
+template <class T>
+static bool parse_list( const char *arg, T (*convert)( const char * ), std::vector< T > & out )
+{
+  out.clear();
+
+  std::string list( arg );
+  size_t start = 0;
+  while ( start <= list.size() ) {
+    size_t end = list.find( ',', start );
+    if ( end == std::string::npos ) {
+      end = list.size();
+    }
+    const std::string item( list.substr( start, end - start ) );
+    if ( item.empty() ) {
+      return false;
+    }
+    out.push_back( convert( item.c_str() ) );
+    start = end + 1;
+  }
+
+  return true;
+}
+
+static int to_int( const char *s ) { return atoi( s ); }
+static double to_double( const char *s ) { return atof( s ); }
+
+class Job
+{
+public:
+  ModelParameters parameters;
+  std::string filename;
+
+  Job( const ModelParameters & s_parameters, const std::string & s_filename )
+    : parameters( s_parameters ), filename( s_filename ) {}
+};
+
+int main( int argc, char *argv[] )
+{
+  const ModelParameters defaults( ReceiverConfig().model );
+
+  std::vector< int > tick_lengths( 1, defaults.tick_length );
+  std::vector< int > bins( 1, defaults.num_bins );
+  std::vector< double > max_rates( 1, defaults.max_arrival_rate );
+  std::vector< double > brownian_rates( 1, defaults.brownian_motion_rate );
+  std::vector< double > outage_escape_rates( 1, defaults.outage_escape_rate );
+  std::vector< int > arrivals_per_tick( 1, defaults.max_arrivals_per_tick );
+  std::vector< int > horizons( 1, defaults.num_ticks );
+  double quantile = ReceiverConfig().quantile;
+  bool single_precision = false, protobuf = false;
+  unsigned int jobs = std::max( 1u, std::thread::hardware_concurrency() );
+
+  static const struct option options[] = {
+    { "tick-length", required_argument, NULL, 't' },
+    { "bins", required_argument, NULL, 'b' },
+    { "max-rate", required_argument, NULL, 'r' },
+    { "brownian-rate", required_argument, NULL, 'm' },
+    { "outage-escape-rate", required_argument, NULL, 'o' },
+    { "arrivals-per-tick", required_argument, NULL, 'a' },
+    { "horizons", required_argument, NULL, 'n' },
+    { "quantile", required_argument, NULL, 'q' },
+    { "float", no_argument, NULL, 'f' },
+    { "protobuf", no_argument, NULL, 'p' },
+    { "jobs", required_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int opt;
+  while ( ( opt = getopt_long( argc, argv, "t:b:r:m:o:a:n:q:fpj:", options, NULL ) ) != -1 ) {
+    bool ok = true;
+    switch ( opt ) {
+    case 't': ok = parse_list( optarg, to_int, tick_lengths ); break;
+    case 'b': ok = parse_list( optarg, to_int, bins ); break;
+    case 'r': ok = parse_list( optarg, to_double, max_rates ); break;
+    case 'm': ok = parse_list( optarg, to_double, brownian_rates ); break;
+    case 'o': ok = parse_list( optarg, to_double, outage_escape_rates ); break;
+    case 'a': ok = parse_list( optarg, to_int, arrivals_per_tick ); break;
+    case 'n': ok = parse_list( optarg, to_int, horizons ); break;
+    case 'q': {
+      char *end;
+      quantile = strtod( optarg, &end );
+      ok = ( *end == '\0' && quantile > 0 && quantile < 1 );
+      break;
+    }
+    case 'f': single_precision = true; break;
+    case 'p': protobuf = true; break;
+    case 'j': ok = ( atoi( optarg ) > 0 ); jobs = atoi( optarg ); break;
+    default: ok = false; break;
+    }
+
+    if ( !ok ) {
+      usage( argv[ 0 ] );
+      return 1;
+    }
+  }
+
+  if ( optind != argc - 1 ) {
+    usage( argv[ 0 ] );
+    return 1;
+  }
+
+  /* every combination */
+  std::vector< Job > grid;
+  for ( auto t = tick_lengths.begin(); t != tick_lengths.end(); t++ )
+    for ( auto b = bins.begin(); b != bins.end(); b++ )
+      for ( auto r = max_rates.begin(); r != max_rates.end(); r++ )
+	for ( auto m = brownian_rates.begin(); m != brownian_rates.end(); m++ )
+	  for ( auto o = outage_escape_rates.begin(); o != outage_escape_rates.end(); o++ )
+	    for ( auto a = arrivals_per_tick.begin(); a != arrivals_per_tick.end(); a++ )
+	      for ( auto n = horizons.begin(); n != horizons.end(); n++ ) {
+		if ( *t <= 0 || *b <= 0 || *r <= 0 || *m < 0 || *o < 0 || *a < 2 || *n <= 0 ) {
+		  fprintf( stderr, "Parameters out of range.\n" );
+		  return 1;
+		}
+
+		ModelParameters parameters;
+		parameters.tick_length = *t;
+		parameters.num_bins = *b;
+		parameters.max_arrival_rate = *r;
+		parameters.brownian_motion_rate = *m;
+		parameters.outage_escape_rate = *o;
+		parameters.max_arrivals_per_tick = *a;
+		parameters.num_ticks = *n;
+		grid.push_back( Job( parameters, argv[ optind ] ) );
+	      }
+
+  if ( grid.size() > 1 ) {
+    for ( auto it = grid.begin(); it != grid.end(); it++ ) {
+      char suffix[ 256 ];
+      snprintf( suffix, sizeof( suffix ), "-t%d-b%d-r%g-m%g-o%g-a%d-n%d",
+		it->parameters.tick_length, it->parameters.num_bins,
+		it->parameters.max_arrival_rate, it->parameters.brownian_motion_rate,
+		it->parameters.outage_escape_rate, it->parameters.max_arrivals_per_tick,
+		it->parameters.num_ticks );
+      it->filename += suffix;
+    }
+  }
+
+  /* models run side by side; the cores left over go to each build */
+  jobs = std::min( jobs, (unsigned int)grid.size() );
+  const unsigned int threads_per_job = std::max( 1u, std::thread::hardware_concurrency() / jobs );
+
+  std::atomic< unsigned int > next_job( 0 );
+  std::mutex output_mutex;
+  const auto start = std::chrono::steady_clock::now();
+
+  auto worker = [&] ( void ) {
+    for ( unsigned int i = next_job++; i < grid.size(); i = next_job++ ) {
+      const Job & job = grid[ i ];
+      const auto job_start = std::chrono::steady_clock::now();
+
+      const Process example( job.parameters.max_arrival_rate,
+			     job.parameters.brownian_motion_rate,
+			     job.parameters.outage_escape_rate,
+			     job.parameters.num_bins );
+
+      const std::vector< ProcessForecastInterval > intervals
+	( ProcessForecastInterval::make_horizons( .001 * job.parameters.tick_length,
+						  example,
+						  job.parameters.max_arrivals_per_tick,
+						  job.parameters.num_ticks,
+						  threads_per_job ) );
+
+      if ( protobuf ) {
+	ForecastModel::write_protobuf( job.filename, intervals );
+      } else {
+	ModelFile::write( job.filename, intervals, job.parameters, quantile, single_precision );
+      }
+
+      const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - job_start;
+      std::lock_guard< std::mutex > lock( output_mutex );
+      fprintf( stderr, "%s: %.3f s\n", job.filename.c_str(), elapsed.count() );
+    }
+  };
+
+  std::vector< std::thread > threads;
+  for ( unsigned int i = 1; i < jobs; i++ ) {
+    threads.push_back( std::thread( worker ) );
+  }
+  worker();
+  for ( auto it = threads.begin(); it != threads.end(); it++ ) {
+    it->join();
+  }
+
+  const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+  fprintf( stderr, "Built %u model%s in %.3f s.\n",
+	   (unsigned int)grid.size(), grid.size() > 1 ? "s" : "", elapsed.count() );
+
+  return 0;
+}
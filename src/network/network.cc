@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
@@ -54,8 +55,8 @@ using namespace Crypto;
 const uint64_t DIRECTION_MASK = uint64_t(1) << 63;
 const uint64_t SEQUENCE_MASK = uint64_t(-1) ^ DIRECTION_MASK;
 
-/* Read in packet from coded string */
-Packet::Packet( string coded_packet, Session *session )
+/* Read in packet from a received datagram */
+Packet::Packet( char *wire, size_t wire_len, Session *session )
   : seq( -1 ),
     direction( TO_SERVER ),
     timestamp( -1 ),
@@ -64,57 +65,102 @@ Packet::Packet( string coded_packet, Session *session )
     time_to_next( -1 ),
     payload()
 {
-  Message message = session->decrypt( coded_packet );
+  Nonce nonce( uint64_t( 0 ) );
+  Slice text = session->decrypt( wire, wire_len, nonce );
 
-  direction = (message.nonce.val() & DIRECTION_MASK) ? TO_CLIENT : TO_SERVER;
-  seq = message.nonce.val() & SEQUENCE_MASK;
+  direction = (nonce.val() & DIRECTION_MASK) ? TO_CLIENT : TO_SERVER;
+  seq = nonce.val() & SEQUENCE_MASK;
 
-  dos_assert( message.text.size() >= 2 * sizeof( uint16_t ) );
+  uint32_t timestamps[ 2 ];
+  uint16_t windows[ 2 ];
+  dos_assert( text.size() >= sizeof( timestamps ) + sizeof( windows ) );
 
-  uint16_t *data = (uint16_t *)message.text.data();
-  timestamp = be16toh( data[ 0 ] );
-  timestamp_reply = be16toh( data[ 1 ] );
-  throwaway_window = be16toh( data[ 2 ] );
-  time_to_next = be16toh( data[ 3 ] );
+  memcpy( timestamps, text.data(), sizeof( timestamps ) );
+  memcpy( windows, text.data() + sizeof( timestamps ), sizeof( windows ) );
+  timestamp = be32toh( timestamps[ 0 ] );
+  timestamp_reply = be32toh( timestamps[ 1 ] );
+  throwaway_window = be16toh( windows[ 0 ] );
+  time_to_next = be16toh( windows[ 1 ] );
 
-  payload = string( message.text.begin() + 4 * sizeof( uint16_t ), message.text.end() );
+  payload = text.substr( sizeof( timestamps ) + sizeof( windows ) );
 }
 
-/* Output coded string from packet */
-string Packet::tostring( Session *session )
+WireBuffer::WireBuffer()
+  : buffer( Session::RECEIVE_MTU ),
+    start( HEADROOM ),
+    end( HEADROOM )
 {
-  uint64_t direction_seq = (uint64_t( direction == TO_CLIENT ) << 63) | (seq & SEQUENCE_MASK);
+}
+
+void WireBuffer::shift( size_t new_start )
+{
+  memmove( buffer.data() + new_start, buffer.data() + start, end - start );
+  end = new_start + end - start;
+  start = new_start;
+}
+
+char *WireBuffer::append( size_t len )
+{
+  if ( end + len > buffer.len() ) {
+    if ( size() + len > buffer.len() ) {
+      throw NetworkException( "datagram too large", EMSGSIZE );
+    }
+    shift( buffer.len() - size() - len );
+  }
 
-  uint16_t ts_net[ 4 ] = { static_cast<uint16_t>( htobe16( timestamp ) ),
-                           static_cast<uint16_t>( htobe16( timestamp_reply ) ),
-			   static_cast<uint16_t>( htobe16( throwaway_window ) ),
-			   static_cast<uint16_t>( htobe16( time_to_next ) ) };
+  end += len;
+  return buffer.data() + end - len;
+}
 
-  string timestamps = string( (char *)ts_net, 4 * sizeof( uint16_t ) );
+char *WireBuffer::prepend( size_t len )
+{
+  if ( len > start ) {
+    if ( size() + len > buffer.len() ) {
+      throw NetworkException( "datagram too large", EMSGSIZE );
+    }
+    shift( len );
+  }
 
-  return session->encrypt( Message( Nonce( direction_seq ), timestamps + payload ) );
+  start -= len;
+  return buffer.data() + start;
 }
 
-Packet Connection::new_packet( const string &s_payload, uint16_t time_to_next )
+void Connection::encode( WireBuffer & wire, uint16_t time_to_next )
 {
-  uint16_t outgoing_timestamp_reply = -1;
+  const size_t payload_len = wire.size();
 
-  uint64_t now = timestamp();
+  uint32_t outgoing_timestamp_reply = -1;
+
+  uint64_t now = timestamp_us();
 
-  if ( now - saved_timestamp_received_at < 1000 ) { /* we have a recent received timestamp */
+  if ( now - saved_timestamp_received_at < 1000000 ) { /* we have a recent received timestamp */
     /* send "corrected" timestamp advanced by how long we held it */
-    outgoing_timestamp_reply = saved_timestamp + (now - saved_timestamp_received_at);
+    outgoing_timestamp_reply = saved_timestamp + (now - saved_timestamp_received_at) / TIMESTAMP_UNIT;
     saved_timestamp = -1;
     saved_timestamp_received_at = 0;
   }
 
   uint16_t throwaway_window = send_queue.add( next_seq );
 
-  Packet p( next_seq, direction, timestamp16(), outgoing_timestamp_reply, throwaway_window, time_to_next, s_payload );
-
-  next_seq += s_payload.size() + 50;
-
-  return p;
+  uint32_t ts_net[ 2 ] = { static_cast<uint32_t>( htobe32( timestamp32() ) ),
+                           static_cast<uint32_t>( htobe32( outgoing_timestamp_reply ) ) };
+  uint16_t windows_net[ 2 ] = { static_cast<uint16_t>( htobe16( throwaway_window ) ),
+				static_cast<uint16_t>( htobe16( time_to_next ) ) };
+  static_assert( sizeof( ts_net ) + sizeof( windows_net ) == SPROUT_HEADER_LEN, "Sprout header size" );
+  char *header = wire.prepend( SPROUT_HEADER_LEN );
+  memcpy( header, ts_net, sizeof( ts_net ) );
+  memcpy( header + sizeof( ts_net ), windows_net, sizeof( windows_net ) );
+
+  /* nonce in front, tag behind */
+  const size_t text_len = wire.size();
+  wire.prepend( 8 );
+  wire.append( Session::TAG_LEN );
+
+  uint64_t direction_seq = (uint64_t( direction == TO_CLIENT ) << 63) | (next_seq & SEQUENCE_MASK);
+  size_t wire_len = session.encrypt( Nonce( direction_seq ), wire.data(), text_len );
+  assert( wire_len == wire.size() );
+
+  next_seq += payload_len + 50;
 }
 
 void Connection::hop_port( void )
@@ -154,7 +200,8 @@ void Connection::setup( void )
   }
 }
 
-Connection::Connection( const char *desired_ip, const char *desired_port ) /* server */
+Connection::Connection( const char *desired_ip, const char *desired_port,
+			const ReceiverConfig & receiver_config ) /* server */
   : sock( -1 ),
     has_remote_addr( false ),
     remote_addr(),
@@ -175,7 +222,10 @@ Connection::Connection( const char *desired_ip, const char *desired_port ) /* se
     RTTVAR( 500 ),
     have_send_exception( false ),
     send_exception(),
-    forecastr(),
+    recv_batch(),
+    send_batch(),
+    gso( true ),
+    forecastr( receiver_config ),
     forecastr_initialized( false ),
     send_queue()
 {
@@ -269,7 +319,8 @@ bool Connection::try_bind( int socket, uint32_t addr, int port )
   return false;
 }
 
-Connection::Connection( const char *key_str, const char *ip, int port ) /* client */
+Connection::Connection( const char *key_str, const char *ip, int port,
+			const ReceiverConfig & receiver_config ) /* client */
   : sock( -1 ),
     has_remote_addr( false ),
     remote_addr(),
@@ -290,7 +341,10 @@ Connection::Connection( const char *key_str, const char *ip, int port ) /* clien
     RTTVAR( 500 ),
     have_send_exception( false ),
     send_exception(),
-    forecastr(),
+    recv_batch(),
+    send_batch(),
+    gso( true ),
+    forecastr( receiver_config ),
     forecastr_initialized( false ),
     send_queue()
 {
@@ -322,25 +376,198 @@ void Connection::send_raw( string s )
 
 void Connection::send( const string & s, uint16_t time_to_next )
 {
+  new_datagram( time_to_next ).append( s.data(), s.size() );
+  send_datagrams();
+}
+
+void Connection::send_many( const std::vector< std::pair< string, uint16_t > > & payloads )
+{
+  for ( auto it = payloads.begin(); it != payloads.end(); it++ ) {
+    new_datagram( it->second ).append( it->first.data(), it->first.size() );
+  }
+  send_datagrams();
+}
+
+/* Datagrams waiting for send_datagrams(), and the messages that carry
+   them to sendmmsg(). A message is one datagram, or with GSO a run of
+   up to GSO_SEGMENTS datagrams of one size (the last may be shorter)
+   sent as one. */
+class Network::SendBatch {
+public:
+  std::vector< std::unique_ptr< WireBuffer > > datagrams; /* kept for reuse */
+  std::vector< uint16_t > times_to_next;
+  unsigned int used; /* datagrams[ 0, used ) are waiting */
+#ifdef HAVE_SENDMMSG
+  static const unsigned int GSO_SEGMENTS = 64; /* the kernel's limit */
+  static const size_t GSO_BYTES = 65000; /* within one IP datagram */
+
+  std::vector< struct iovec > iovecs; /* one per datagram */
+  std::vector< struct mmsghdr > headers;
+  std::vector< unsigned int > counts; /* datagrams per header */
+  std::vector< char > controls;
+
+  SendBatch() : datagrams(), times_to_next(), used( 0 ), iovecs(), headers(), counts(), controls() {}
+
+  /* messages for datagrams[ first, last ), returning how many */
+  unsigned int prepare( const unsigned int first, const unsigned int last,
+			struct sockaddr_in & addr, const bool gso );
+#else
+  SendBatch() : datagrams(), times_to_next(), used( 0 ) {}
+#endif
+};
+
+#ifdef HAVE_SENDMMSG
+unsigned int Network::SendBatch::prepare( const unsigned int first, const unsigned int last,
+					 struct sockaddr_in & addr, const bool gso )
+{
+  const size_t n = last - first;
+  const size_t control_size = CMSG_SPACE( sizeof( uint16_t ) );
+
+  iovecs.resize( n );
+  headers.resize( n );
+  counts.resize( n );
+  controls.resize( n * control_size );
+
+  for ( size_t i = 0; i < n; i++ ) {
+    iovecs[ i ].iov_base = datagrams[ first + i ]->data();
+    iovecs[ i ].iov_len = datagrams[ first + i ]->size();
+  }
+
+  unsigned int messages = 0;
+  for ( size_t i = 0; i < n; messages++ ) {
+    const size_t segment = iovecs[ i ].iov_len;
+    size_t end = i + 1, bytes = segment;
+
+#ifdef UDP_SEGMENT
+    if ( gso ) {
+      while ( end < n && end - i < GSO_SEGMENTS
+	      && iovecs[ end ].iov_len <= segment
+	      && bytes + iovecs[ end ].iov_len <= GSO_BYTES ) {
+	bytes += iovecs[ end ].iov_len;
+	if ( iovecs[ end++ ].iov_len < segment ) {
+	  break; /* only the last may be short */
+	}
+      }
+    }
+#else
+    (void)gso;
+#endif
+
+    struct msghdr & msg = headers[ messages ].msg_hdr;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof( addr );
+    msg.msg_iov = &iovecs[ i ];
+    msg.msg_iovlen = end - i;
+
+#ifdef UDP_SEGMENT
+    if ( end - i > 1 ) {
+      msg.msg_control = &controls[ messages * control_size ];
+      msg.msg_controllen = control_size;
+
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+      const uint16_t segment_size = segment;
+      memcpy( CMSG_DATA( cmsg ), &segment_size, sizeof( segment_size ) );
+    }
+#endif
+
+    counts[ messages ] = end - i;
+    i = end;
+  }
+
+  return messages;
+}
+#endif
+
+WireBuffer & Connection::new_datagram( uint16_t time_to_next, size_t above_len )
+{
+  if ( !send_batch ) {
+    send_batch.reset( new SendBatch );
+  }
+
+  SendBatch & batch = *send_batch;
+  if ( batch.used == batch.datagrams.size() ) {
+    batch.datagrams.push_back( std::unique_ptr< WireBuffer >( new WireBuffer ) );
+    batch.times_to_next.push_back( 0 );
+  }
+
+  batch.times_to_next[ batch.used ] = time_to_next;
+  WireBuffer & wire = *batch.datagrams[ batch.used++ ];
+
+  /* the text (Sprout header onwards) on a 16-byte boundary */
+  wire.clear( ( SPROUT_HEADER_LEN + above_len ) % 16 );
+  return wire;
+}
+
+void Connection::send_datagrams( void )
+{
+  if ( !send_batch || send_batch->used == 0 ) {
+    return;
+  }
+
+  SendBatch & batch = *send_batch;
+  const unsigned int count = batch.used;
+  batch.used = 0;
+
   if ( !has_remote_addr ) {
     return;
   }
 
-  Packet px = new_packet( s, time_to_next );
+  for ( unsigned int i = 0; i < count; i++ ) {
+    encode( *batch.datagrams[ i ], batch.times_to_next[ i ] );
+  }
+
+#ifdef HAVE_SENDMMSG
+  unsigned int sent = 0;
+  bool success = true;
+  while ( sent < count ) {
+    const unsigned int messages = batch.prepare( sent, count, remote_addr, gso );
+    const int accepted = sendmmsg( sock, batch.headers.data(), messages, 0 );
+
+    if ( accepted < 0 ) {
+      if ( gso && ( errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP ) ) {
+	gso = false; /* try again the old way */
+	continue;
+      }
+      success = false;
+      break;
+    }
+
+    for ( int i = 0; i < accepted; i++ ) {
+      sent += batch.counts[ i ];
+    }
+  }
 
-  string p = px.tostring( &session );
+  finish_send( success, "sendmmsg" );
+#else
+  bool success = true;
+  for ( unsigned int i = 0; i < count; i++ ) {
+    const WireBuffer & wire = *batch.datagrams[ i ];
+    ssize_t bytes_sent = sendto( sock, wire.data(), wire.size(), 0,
+				 (sockaddr *)&remote_addr, sizeof( remote_addr ) );
+    if ( bytes_sent != static_cast<ssize_t>( wire.size() ) ) {
+      success = false;
+      break;
+    }
+  }
 
-  ssize_t bytes_sent = sendto( sock, p.data(), p.size(), 0,
-			       (sockaddr *)&remote_addr, sizeof( remote_addr ) );
+  finish_send( success, "sendto" );
+#endif
+}
 
-  if ( bytes_sent == static_cast<ssize_t>( p.size() ) ) {
+void Connection::finish_send( bool success, const char *call )
+{
+  if ( success ) {
     have_send_exception = false;
   } else {
     /* Notify the frontend on sendto() failure, but don't alter control flow.
        sendto() success is not very meaningful because packets can be lost in
        flight anyway. */
     have_send_exception = true;
-    send_exception = NetworkException( "sendto", errno );
+    send_exception = NetworkException( call, errno );
   }
 
   uint64_t now = timestamp();
@@ -395,20 +622,112 @@ string Connection::recv_raw( void )
   return string( buf, received_len );
 }
 
+/* One datagram per slot, reused from call to call. Each starts 8 bytes
+   into its slot, so the text after the nonce is 16-byte aligned for
+   decryption in place. */
+class Network::RecvBatch {
+public:
+  static const size_t SLOT = Session::RECEIVE_MTU + 16;
+
+  AlignedBuffer buffers;
+  std::vector< struct sockaddr_in > addrs;
+#ifdef HAVE_RECVMMSG
+  std::vector< struct iovec > iovecs;
+  std::vector< struct mmsghdr > headers;
+#endif
+
+  RecvBatch( const unsigned int size )
+    : buffers( size * SLOT ),
+      addrs( size )
+#ifdef HAVE_RECVMMSG
+    , iovecs( size ),
+      headers( size )
+#endif
+  {
+#ifdef HAVE_RECVMMSG
+    for ( unsigned int i = 0; i < size; i++ ) {
+      iovecs[ i ].iov_base = buffer( i );
+      iovecs[ i ].iov_len = Session::RECEIVE_MTU;
+      memset( &headers[ i ], 0, sizeof( headers[ i ] ) );
+      headers[ i ].msg_hdr.msg_iov = &iovecs[ i ];
+      headers[ i ].msg_hdr.msg_iovlen = 1;
+      headers[ i ].msg_hdr.msg_name = &addrs[ i ];
+    }
+#endif
+  }
+
+  char *buffer( const unsigned int i ) { return buffers.data() + i * SLOT + 8; }
+
+  /* not implemented */
+  RecvBatch( const RecvBatch & );
+  RecvBatch & operator=( const RecvBatch & );
+};
+
+RecvBatch & Connection::get_recv_batch( void )
+{
+  if ( !recv_batch ) {
+    recv_batch.reset( new RecvBatch( RECV_BATCH ) );
+  }
+  return *recv_batch;
+}
+
 string Connection::recv( void )
 {
-  struct sockaddr_in packet_remote_addr;
+  return recv_slice().tostring();
+}
 
-  char buf[ Session::RECEIVE_MTU ];
+Slice Connection::recv_slice( void )
+{
+  RecvBatch & batch = get_recv_batch();
+
+  struct sockaddr_in & packet_remote_addr = batch.addrs[ 0 ];
 
   socklen_t addrlen = sizeof( packet_remote_addr );
 
-  ssize_t received_len = recvfrom( sock, buf, Session::RECEIVE_MTU, 0, (sockaddr *)&packet_remote_addr, &addrlen );
+  ssize_t received_len = recvfrom( sock, batch.buffer( 0 ), Session::RECEIVE_MTU, 0, (sockaddr *)&packet_remote_addr, &addrlen );
 
   if ( received_len < 0 ) {
     throw NetworkException( "recvfrom", errno );
   }
 
+  return receive( batch.buffer( 0 ), received_len, packet_remote_addr );
+}
+
+void Connection::recv_many( std::vector< Slice > & payloads )
+{
+  payloads.clear();
+
+#ifdef HAVE_RECVMMSG
+  RecvBatch & batch = get_recv_batch();
+  for ( unsigned int i = 0; i < RECV_BATCH; i++ ) {
+    batch.headers[ i ].msg_hdr.msg_namelen = sizeof( batch.addrs[ i ] );
+  }
+
+  /* wait for one, then take whatever else is already queued */
+  int received = recvmmsg( sock, batch.headers.data(), RECV_BATCH, MSG_WAITFORONE, NULL );
+
+  if ( received < 0 ) {
+    throw NetworkException( "recvmmsg", errno );
+  }
+
+  for ( int i = 0; i < received; i++ ) {
+    try {
+      payloads.push_back( receive( batch.buffer( i ), batch.headers[ i ].msg_len, batch.addrs[ i ] ) );
+    } catch ( const CryptoException & ) {
+      /* not ours, or damaged */
+    }
+  }
+#else
+  try {
+    payloads.push_back( recv_slice() );
+  } catch ( const CryptoException & ) {
+    /* not ours, or damaged */
+  }
+#endif
+}
+
+Slice Connection::receive( char *buf, ssize_t received_len, const struct sockaddr_in & packet_remote_addr )
+{
   if ( received_len > Session::RECEIVE_MTU ) {
     char buffer[ 2048 ];
     snprintf( buffer, 2048, "Received oversize datagram (size %d) and limit is %d\n",
@@ -416,31 +735,31 @@ string Connection::recv( void )
     throw NetworkException( buffer, errno );
   }
 
-  Packet p( string( buf, received_len ), &session );
+  Packet p( buf, received_len, &session );
 
   dos_assert( p.direction == (server ? TO_SERVER : TO_CLIENT) ); /* prevent malicious playback to sender */
 
   /* Update Sprout */
   if ( !forecastr_initialized ) {
-    forecastr.warp_to( timestamp() );
+    forecastr.warp_to_us( timestamp_us() );
     forecastr_initialized = true;
   }
 
-  forecastr.advance_to( timestamp() );
+  forecastr.advance_to_us( timestamp_us() );
   forecastr.recv( p.seq, p.throwaway_window, p.time_to_next, p.payload.size() );
 
   if ( p.seq >= expected_receiver_seq ) { /* don't use out-of-order packets for timestamp or targeting */
     expected_receiver_seq = p.seq + 1; /* this is security-sensitive because a replay attack could otherwise
 					  screw up the timestamp and targeting */
 
-    if ( p.timestamp != uint16_t(-1) ) {
+    if ( p.timestamp != uint32_t(-1) ) {
       saved_timestamp = p.timestamp;
-      saved_timestamp_received_at = timestamp();
+      saved_timestamp_received_at = timestamp_us();
     }
 
-    if ( p.timestamp_reply != uint16_t(-1) ) {
-      uint16_t now = timestamp16();
-      double R = timestamp_diff( now, p.timestamp_reply );
+    if ( p.timestamp_reply != uint32_t(-1) ) {
+      uint32_t now = timestamp32();
+      double R = timestamp_diff( now, p.timestamp_reply ) * ( TIMESTAMP_UNIT / 1000.0 ); /* ms */
 
       if ( R < 50000 ) { /* ignore very large values */
 	if ( !RTT_hit ) { /* first measurement */
@@ -492,26 +811,24 @@ uint64_t Network::timestamp( void )
   return frozen_timestamp();
 }
 
-uint16_t Network::timestamp16( void )
+uint64_t Network::timestamp_us( void )
 {
-  uint16_t ts = timestamp() % 65536;
-  if ( ts == uint16_t(-1) ) {
+  return frozen_timestamp_us();
+}
+
+uint32_t Network::timestamp32( void )
+{
+  uint32_t ts = timestamp_us() / TIMESTAMP_UNIT;
+  if ( ts == uint32_t(-1) ) {
     ts++;
   }
   return ts;
 }
 
-uint16_t Network::timestamp_diff( uint16_t tsnew, uint16_t tsold )
+uint32_t Network::timestamp_diff( uint32_t tsnew, uint32_t tsold )
 {
-  int diff = tsnew - tsold;
-  if ( diff < 0 ) {
-    diff += 65536;
-  }
-  
-  assert( diff >= 0 );
-  assert( diff <= 65535 );
-
-  return diff;
+  /* modulo 2^32, across a wrap */
+  return tsnew - tsold;
 }
 
 uint64_t Connection::timeout( void ) const
@@ -534,7 +851,7 @@ Connection::~Connection()
 
 uint16_t SendQueue::add( const uint64_t seq )
 {
-  uint64_t now = timestamp();
+  uint64_t now = timestamp_us();
 
   sent_packets.push( make_pair( seq, now ) );
 
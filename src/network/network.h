@@ -39,18 +39,25 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string>
+#include <vector>
+#include <memory>
 #include <math.h>
 
 #include "crypto.h"
+#include "slice.h"
 
 #include "receiver.hh"
 
 using namespace Crypto;
 
 namespace Network {
-  uint64_t timestamp( void );
-  uint16_t timestamp16( void );
-  uint16_t timestamp_diff( uint16_t tsnew, uint16_t tsold );
+  uint64_t timestamp( void ); /* ms */
+  uint64_t timestamp_us( void );
+
+  /* packet timestamps count in units of 100 us, wrapping every 5 days */
+  static const uint64_t TIMESTAMP_UNIT = 100; /* us */
+  uint32_t timestamp32( void );
+  uint32_t timestamp_diff( uint32_t tsnew, uint32_t tsold );
 
   class NetworkException {
   public:
@@ -69,26 +76,53 @@ namespace Network {
   public:
     uint64_t seq;
     Direction direction;
-    uint16_t timestamp, timestamp_reply, throwaway_window, time_to_next;
-    string payload;
-    
-    Packet( uint64_t s_seq, Direction s_direction,
-	    uint16_t s_timestamp, uint16_t s_timestamp_reply, uint16_t s_throwaway_window, uint16_t s_time_to_next, const string & s_payload )
-      : seq( s_seq ), direction( s_direction ),
-      timestamp( s_timestamp ), timestamp_reply( s_timestamp_reply ), throwaway_window( s_throwaway_window ), time_to_next( s_time_to_next ),
-	payload( s_payload )
-    {}
-    
-    Packet( string coded_packet, Session *session );
+    uint32_t timestamp, timestamp_reply;
+    uint16_t throwaway_window, time_to_next;
+    Slice payload; /* within the decrypted datagram */
     
-    string tostring( Session *session );
+    /* decrypts the datagram in place */
+    Packet( char *wire, size_t wire_len, Session *session );
+  };
+
+  /* One outgoing datagram, built in place. The payload is appended
+     once, then each layer below prepends its header into the room left
+     at the front, down to the nonce; encryption happens where it lies. */
+  class WireBuffer {
+  private:
+    AlignedBuffer buffer; /* RECEIVE_MTU, the most a peer will take */
+    size_t start, end;
+
+    /* moves the contents to begin at new_start */
+    void shift( size_t new_start );
+
+  public:
+    /* enough for the nonce, the Sprout header and a forecast */
+    static const size_t HEADROOM = 256;
+
+    WireBuffer();
+
+    /* the payload will begin offset bytes past HEADROOM */
+    void clear( size_t offset = 0 ) { start = end = HEADROOM + offset; }
+
+    /* room for len more bytes at the back or the front */
+    char *append( size_t len );
+    char *prepend( size_t len );
+    void append( const char *data, size_t len ) { memcpy( append( len ), data, len ); }
+
+    const char *data( void ) const { return buffer.data() + start; }
+    char *data( void ) { return buffer.data() + start; }
+    size_t size( void ) const { return end - start; }
+
+    /* not implemented */
+    WireBuffer( const WireBuffer & );
+    WireBuffer & operator=( const WireBuffer & );
   };
 
   class SendQueue {
   private:
-    std::queue< std::pair< uint64_t, uint64_t > > sent_packets; /* seq, ts */
+    std::queue< std::pair< uint64_t, uint64_t > > sent_packets; /* seq, ts (us) */
 
-    static const int REORDER_LIMIT = 10; /* ms */
+    static const uint64_t REORDER_LIMIT = 10000; /* us */
 
   public:
     SendQueue() : sent_packets() {}
@@ -96,9 +130,13 @@ namespace Network {
     uint16_t add( const uint64_t seq ); /* returns throwaway */
   };
 
+  class RecvBatch;
+  class SendBatch;
+
   class Connection {
   private:
     static const int SEND_MTU = 1400;
+    static const size_t SPROUT_HEADER_LEN = 12; /* timestamps, throwaway window, time to next */
     static const uint64_t MIN_RTO = 50; /* ms */
     static const uint64_t MAX_RTO = 5000; /* ms */
 
@@ -125,8 +163,8 @@ namespace Network {
 
     Direction direction;
     uint64_t next_seq;
-    uint16_t saved_timestamp;
-    uint64_t saved_timestamp_received_at;
+    uint32_t saved_timestamp;
+    uint64_t saved_timestamp_received_at; /* us */
     uint64_t expected_receiver_seq;
 
     uint64_t last_heard;
@@ -134,15 +172,31 @@ namespace Network {
     uint64_t last_roundtrip_success; /* transport layer needs to tell us this */
 
     bool RTT_hit;
-    double SRTT;
-    double RTTVAR;
+    double SRTT; /* ms */
+    double RTTVAR; /* ms */
 
     /* Exception from send(), to be delivered if the frontend asks for it,
        without altering control flow. */
     bool have_send_exception;
     NetworkException send_exception;
 
-    Packet new_packet( const string &s_payload, uint16_t time_to_next );
+    /* adds the Sprout header and nonce to a payload, and encrypts */
+    void encode( WireBuffer & wire, uint16_t time_to_next );
+
+    /* after sending, whether or not it worked (errno says why not) */
+    void finish_send( bool success, const char *call );
+
+    /* the payload of a received datagram, after updating Sprout, the
+       RTT estimate and the remote address; decrypted in place */
+    Slice receive( char *buf, ssize_t received_len, const struct sockaddr_in & packet_remote_addr );
+
+    /* receive buffers, made on first use */
+    std::unique_ptr< RecvBatch > recv_batch;
+    RecvBatch & get_recv_batch( void );
+
+    /* buffers for send_many(), made on first use */
+    std::unique_ptr< SendBatch > send_batch;
+    bool gso; /* cleared if the kernel refuses UDP_SEGMENT */
 
     void hop_port( void );
 
@@ -153,13 +207,42 @@ namespace Network {
     SendQueue send_queue;
 
   public:
-    Connection( const char *desired_ip, const char *desired_port ); /* server */
-    Connection( const char *key_str, const char *ip, int port ); /* client */
+    Connection( const char *desired_ip, const char *desired_port,
+		const ReceiverConfig & receiver_config = ReceiverConfig() ); /* server */
+    Connection( const char *key_str, const char *ip, int port,
+		const ReceiverConfig & receiver_config = ReceiverConfig() ); /* client */
     ~Connection();
 
     void send( const string & s, uint16_t time_to_next = 0 );
     string recv( void );
 
+    /* As recv(), but the payload is left where it was decrypted, in
+       the connection's receive buffer, until the next receive. */
+    Slice recv_slice( void );
+
+    /* The payloads of every datagram waiting, up to RECV_BATCH (one
+       system call where recvmmsg() exists), each handled as by
+       recv_slice(). Blocks for the first, like recv(); datagrams that
+       fail to decrypt are dropped rather than thrown, so the rest
+       survive. */
+    static const unsigned int RECV_BATCH = 32;
+    void recv_many( std::vector< Slice > & payloads );
+
+    /* Each (payload, time_to_next) as by send(), in order, with as few
+       system calls as the platform allows: one sendmmsg() for the lot,
+       where runs of same-size datagrams also go as single UDP GSO
+       (UDP_SEGMENT) sends, split up by the kernel or the NIC. */
+    void send_many( const std::vector< std::pair< string, uint16_t > > & payloads );
+
+    /* The same without copies: fill in each datagram's payload (and
+       the headers of any layers above, above_len bytes in all, which
+       lets the cipher find the text aligned), then send them all at
+       once. */
+    WireBuffer & new_datagram( uint16_t time_to_next, size_t above_len = 0 );
+    void send_datagrams( void );
+    void set_gso( bool s_gso ) { gso = s_gso; }
+    bool get_gso( void ) const { return gso; }
+
     void send_raw( string s );
     string recv_raw( void );
 
@@ -182,7 +265,7 @@ namespace Network {
 
     void set_last_roundtrip_success( uint64_t s_success ) { last_roundtrip_success = s_success; }
 
-    Sprout::DeliveryForecast forecast( void ) { forecastr.advance_to( timestamp() ); return forecastr.forecast(); }
+    Sprout::DeliveryForecast forecast( void ) { forecastr.advance_to_us( timestamp_us() ); return forecastr.forecast(); }
 
     uint64_t get_next_seq( void ) const { return next_seq; }
     int get_tick_length( void ) const { return forecastr.get_tick_length(); }
@@ -69,8 +69,8 @@ Transport<MyState, RemoteState>::Transport( MyState &initial_state, RemoteState
 template <class MyState, class RemoteState>
 void Transport<MyState, RemoteState>::recv( void )
 {
-  string s( connection.recv() );
-  Fragment frag( s );
+  /* decoded where it was received; kept only if it must wait for more */
+  Fragment frag( connection.recv_slice() );
 
   if ( fragments.add_fragment( frag ) ) { /* complete packet */
     Instruction inst = fragments.get_assembly();
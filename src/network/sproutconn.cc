@@ -1,62 +1,103 @@
 #include "sproutconn.h"
+#include "dos_assert.h"
+#include "fatal_assert.h"
 
 using namespace Network;
 
-SproutConnection::SproutConnection( const char *desired_ip, const char *desired_port )
-  : conn( desired_ip, desired_port ),
+SproutConnection::SproutConnection( const char *desired_ip, const char *desired_port,
+				    const ReceiverConfig & receiver_config )
+  : conn( desired_ip, desired_port, receiver_config ),
     local_forecast_time( 0 ),
     remote_forecast_time( 0 ),
     last_outgoing_ended_flight( true ),
     current_queue_bytes_estimate( 0 ),
     current_forecast_tick( 0 ),
     operative_forecast( conn.forecast() ), /* something reasonable */
+    incoming_forecast(),
+    risk( receiver_config.quantile ),
+    operative_counts(),
+    operative_level( ForecastLevels::select( operative_forecast, risk, operative_counts ) ),
     outgoing_queue()
 {}
 
-SproutConnection::SproutConnection( const char *key_str, const char *ip, int port )
-  : conn( key_str, ip, port ),
+SproutConnection::SproutConnection( const char *key_str, const char *ip, int port,
+				    const ReceiverConfig & receiver_config )
+  : conn( key_str, ip, port, receiver_config ),
     local_forecast_time( 0 ),
     remote_forecast_time( 0 ),
     last_outgoing_ended_flight( true ),
     current_queue_bytes_estimate( 0 ),
     current_forecast_tick( 0 ),
     operative_forecast( conn.forecast() ), /* something reasonable */
+    incoming_forecast(),
+    risk( receiver_config.quantile ),
+    operative_counts(),
+    operative_level( ForecastLevels::select( operative_forecast, risk, operative_counts ) ),
     outgoing_queue()
 {}
 
 void SproutConnection::send( const string & s, uint16_t time_to_next )
 {
-  ForecastPacket to_send( false, s );
+  frame( s, time_to_next );
+  conn.send_datagrams();
+}
 
+void SproutConnection::send_many( const std::vector< std::pair< string, uint16_t > > & payloads )
+{
+  for ( auto it = payloads.begin(); it != payloads.end(); it++ ) {
+    frame( it->first, it->second );
+  }
+  conn.send_datagrams();
+}
+
+void SproutConnection::frame( const string & s, uint16_t time_to_next )
+{
   /* consider forecast */
+  uint16_t forecast_size = 0;
+  Sprout::DeliveryForecast the_fc;
+
   if ( last_outgoing_ended_flight ) {
-    Sprout::DeliveryForecast the_fc = conn.forecast();
+    the_fc = conn.forecast();
 
     if ( the_fc.time() != local_forecast_time ) {
-      to_send.add_forecast( the_fc );
+      const size_t size = the_fc.ByteSizeLong();
+      fatal_assert( size <= 65535 );
+      forecast_size = size;
       local_forecast_time = the_fc.time();
     }
   }
 
-  last_outgoing_ended_flight = ( time_to_next > 0 );
+  const size_t header_len = sizeof( forecast_size ) + forecast_size;
+  WireBuffer & wire = conn.new_datagram( time_to_next, header_len );
+  wire.append( s.data(), s.size() );
 
-  const string outgoing( to_send.tostring() );
+  /* size, then the forecast itself, ahead of the data */
+  char *header = wire.prepend( header_len );
+  memcpy( header, &forecast_size, sizeof( forecast_size ) );
+  if ( forecast_size ) {
+    the_fc.SerializeWithCachedSizesToArray( (uint8_t *)header + sizeof( forecast_size ) );
+  }
 
-  conn.send( outgoing, time_to_next );
+  last_outgoing_ended_flight = ( time_to_next > 0 );
 
-  current_queue_bytes_estimate += outgoing.size();
+  current_queue_bytes_estimate += wire.size();
   update_queue_estimate();
 }
 
+int SproutConnection::remote_tick_length( void ) const
+{
+  return operative_forecast.has_tick_length() ? operative_forecast.tick_length() : DEFAULT_TICK_LENGTH;
+}
+
 void SproutConnection::update_queue_estimate( void )
 {
-  uint64_t now = timestamp();
+  uint64_t now = timestamp_us();
   /* investigate decrementing current forecast */
-  int new_forecast_tick = std::min( int((now - remote_forecast_time) / conn.get_tick_length()),
-				    operative_forecast.counts_size() - 1 );
+  int new_forecast_tick = std::min( int((now - remote_forecast_time) / (1000 * remote_tick_length())),
+				    int( operative_counts.size() ) - 1 );
 
   while ( current_forecast_tick < new_forecast_tick ) {
-    current_queue_bytes_estimate -= 1440 * operative_forecast.counts( current_forecast_tick );
+    current_queue_bytes_estimate -= 1440 * operative_counts[ current_forecast_tick ];
     if ( current_queue_bytes_estimate < 0 ) current_queue_bytes_estimate = 0;
 
     current_forecast_tick++;
@@ -65,11 +106,47 @@ void SproutConnection::update_queue_estimate( void )
 
 string SproutConnection::recv( void )
 {
-  ForecastPacket packet( conn.recv() );
+  return recv_slice().tostring();
+}
 
-  if ( packet.has_forecast() ) {
-    operative_forecast = packet.forecast();
-    remote_forecast_time = timestamp(); // - conn.get_SRTT()/4;
+Slice SproutConnection::recv_slice( void )
+{
+  return receive( conn.recv_slice() );
+}
+
+void SproutConnection::recv_many( std::vector< Slice > & payloads )
+{
+  conn.recv_many( payloads );
+
+  /* as in Connection::recv_many(), bad datagrams are dropped */
+  auto kept = payloads.begin();
+  for ( auto it = payloads.begin(); it != payloads.end(); it++ ) {
+    try {
+      *kept = receive( *it );
+      kept++;
+    } catch ( const CryptoException & ) {
+      /* not ours, or damaged */
+    }
+  }
+  payloads.erase( kept, payloads.end() );
+}
+
+Slice SproutConnection::receive( const Slice & datagram )
+{
+  /* size, then the forecast itself, ahead of the data */
+  uint16_t forecast_size;
+  dos_assert( datagram.size() >= sizeof( forecast_size ) );
+  memcpy( &forecast_size, datagram.data(), sizeof( forecast_size ) );
+  dos_assert( datagram.size() >= sizeof( forecast_size ) + forecast_size );
+
+  if ( forecast_size ) {
+    /* parsed from the receive buffer into storage kept for reuse */
+    dos_assert( incoming_forecast.ParseFromArray( datagram.data() + sizeof( forecast_size ), forecast_size ) );
+    dos_assert( !incoming_forecast.has_tick_length()
+		|| ( incoming_forecast.tick_length() > 0 && incoming_forecast.tick_length() <= 65535 ) );
+    operative_forecast.Swap( &incoming_forecast );
+    operative_level = ForecastLevels::select( operative_forecast, risk, operative_counts );
+    remote_forecast_time = timestamp_us(); // - conn.get_SRTT()/4;
     current_queue_bytes_estimate = conn.get_next_seq() - operative_forecast.received_or_lost_count();
     assert( current_queue_bytes_estimate >= 0 );
     current_forecast_tick = 0;
@@ -77,20 +154,20 @@ string SproutConnection::recv( void )
     update_queue_estimate();
   }
 
-  return packet.data();
+  return datagram.substr( sizeof( forecast_size ) + forecast_size );
 }
 
 int SproutConnection::window_size( void )
 {
   update_queue_estimate();
 
-  int cumulative_delivery_tick = current_forecast_tick + TARGET_DELAY_TICKS;
-  if ( cumulative_delivery_tick >= operative_forecast.counts_size() ) {
-    cumulative_delivery_tick = operative_forecast.counts_size() - 1;
+  int cumulative_delivery_tick = current_forecast_tick + std::max( 1, TARGET_DELAY / remote_tick_length() );
+  if ( cumulative_delivery_tick >= int( operative_counts.size() ) ) {
+    cumulative_delivery_tick = operative_counts.size() - 1;
   }
 
-  int cumulative_delivery_forecast = 1440 * ( operative_forecast.counts( cumulative_delivery_tick )
-					      - operative_forecast.counts( current_forecast_tick ) );
+  int cumulative_delivery_forecast = 1440 * ( operative_counts[ cumulative_delivery_tick ]
+					      - operative_counts[ current_forecast_tick ] );
 
   int bytes_to_send = cumulative_delivery_forecast - current_queue_bytes_estimate;
 
@@ -108,8 +185,8 @@ int SproutConnection::window_size( void )
   /*
   if ( bytes_to_send > 0 ) {
     fprintf( stderr, "From tick %d(%d) => %d(%d), %d bytes to send with %d already sent\n",
-	     current_forecast_tick, operative_forecast.counts( current_forecast_tick ),
-	     cumulative_delivery_tick, operative_forecast.counts( cumulative_delivery_tick ),
+	     current_forecast_tick, operative_counts[ current_forecast_tick ],
+	     cumulative_delivery_tick, operative_counts[ cumulative_delivery_tick ],
 	     bytes_to_send, current_queue_bytes_estimate );
   }
   */
@@ -117,6 +194,12 @@ int SproutConnection::window_size( void )
   return bytes_to_send;
 }
 
+void SproutConnection::set_risk( const double quantile )
+{
+  risk = quantile;
+  operative_level = ForecastLevels::select( operative_forecast, risk, operative_counts );
+}
+
 void SproutConnection::queue_to_send( const string & s, uint16_t time_to_next )
 {
   outgoing_queue.push_back( make_pair( s, time_to_next ) );
@@ -128,6 +211,7 @@ void SproutConnection::tick( void )
     return;
   }
 
+  /* everything the window allows goes out together */
   while ( (!outgoing_queue.empty())
 	  && (window_size() >= (int)outgoing_queue.front().first.size()) ) {
     /* send it */
@@ -143,6 +227,8 @@ void SproutConnection::tick( void )
       time_to_next = 0;
     }
 
-    send( s, time_to_next );
+    frame( s, time_to_next );
   }
+
+  conn.send_datagrams();
 }
@@ -3,90 +3,67 @@
 
 #include "network.h"
 #include "deliveryforecast.pb.h"
+#include "forecastlevels.hh"
 
 namespace Network {
   class SproutConnection
   {
   private:
-    class ForecastPacket
-    {
-    private:
-      string _forecast, _data;
-      
-    public:
-      ForecastPacket() : _forecast(), _data() {}
-      
-      /* No forecast update */
-      ForecastPacket( bool, const string & s_data )
-	: _forecast(),
-	  _data( s_data )
-      {}
-      
-      void add_forecast( const Sprout::DeliveryForecast & s_forecast )
-      {
-	_forecast = s_forecast.SerializeAsString();
-	assert( _forecast.size() <= 65535 );
-      }
-      
-      ForecastPacket( const string & incoming )
-	: _forecast( incoming.substr( sizeof( uint16_t ), *(uint16_t *) incoming.data() ) ),
-	  _data( incoming.substr( sizeof( uint16_t ) + _forecast.size() ) )
-      {}
-      
-      string tostring( void ) const
-      {
-	uint16_t forecast_size = _forecast.size();
-	string ret( (char *) & forecast_size, sizeof( forecast_size ) );
-	if ( forecast_size ) {
-	  ret.append( _forecast );
-	}
-	ret.append( _data );
-	
-	return ret;
-      }
-      
-      bool has_forecast( void ) const { return _forecast.size() > 0; }
-      
-      Sprout::DeliveryForecast forecast( void ) const
-      {
-	assert( has_forecast() );
-	
-	Sprout::DeliveryForecast ret;
-	assert( ret.ParseFromString( _forecast ) );
-	
-	return ret;
-      }
-
-      string data( void ) const { return _data; }
-    };      
-
     Connection conn;
 
-    static const int TARGET_DELAY_TICKS = 5;
+    static const int TARGET_DELAY = 100; /* ms */
+    static const int DEFAULT_TICK_LENGTH = 20; /* ms, for forecasts without one */
     uint64_t local_forecast_time;
-    uint64_t remote_forecast_time;
+    uint64_t remote_forecast_time; /* us */
     bool last_outgoing_ended_flight;
     int current_queue_bytes_estimate;
     int current_forecast_tick;
 
-    Sprout::DeliveryForecast operative_forecast;
+    Sprout::DeliveryForecast operative_forecast, incoming_forecast;
+
+    /* quantile of the remote forecast to send against, and the level
+       (of those offered) actually in use */
+    double risk;
+    std::vector< int > operative_counts;
+    double operative_level;
 
     void update_queue_estimate( void );
 
+    /* the peer's ticks, which its forecast counts in (ms) */
+    int remote_tick_length( void ) const;
+
+    /* the data, after taking any forecast */
+    Slice receive( const Slice & datagram );
+
     std::deque< std::pair< const string, uint16_t > > outgoing_queue;
 
+    /* into the connection's next datagram, with any forecast, and
+       counted in the queue estimate */
+    void frame( const string & s, uint16_t time_to_next );
+
   public:
-    SproutConnection( const char *desired_ip, const char *desired_port ); /* server */
-    SproutConnection( const char *key_str, const char *ip, int port ); /* client */
+    SproutConnection( const char *desired_ip, const char *desired_port,
+		      const ReceiverConfig & receiver_config = ReceiverConfig() ); /* server */
+    SproutConnection( const char *key_str, const char *ip, int port,
+		      const ReceiverConfig & receiver_config = ReceiverConfig() ); /* client */
 
     void send( const string & s, uint16_t time_to_next = 0 );
+    /* as send() of each, in as few system calls as possible */
+    void send_many( const std::vector< std::pair< string, uint16_t > > & payloads );
     void queue_to_send( const string & s, uint16_t time_to_next = 0 );
     string recv( void );
 
+    /* views into the receive buffer, as Connection's */
+    Slice recv_slice( void );
+
+    /* every datagram waiting, up to Connection::RECV_BATCH */
+    void recv_many( std::vector< Slice > & payloads );
+
     int fd( void ) const { return conn.fd(); }
     int get_MTU( void ) const { return conn.get_MTU(); }
 
     int port( void ) const { return conn.port(); }
+    string get_key( void ) const { return conn.get_key(); }
     bool get_has_remote_addr( void ) const { return conn.get_has_remote_addr(); }
 
     uint64_t timeout( void ) const { return conn.timeout(); }
@@ -97,6 +74,11 @@ namespace Network {
 
     int window_size( void );
 
+    /* lower is more conservative; takes effect from the current forecast */
+    void set_risk( const double quantile );
+    double get_risk( void ) const { return risk; }
+    double get_operative_level( void ) const { return operative_level; }
+
     void tick( void );
   };
 }
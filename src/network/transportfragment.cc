@@ -36,6 +36,7 @@
 #include "transportfragment.h"
 #include "transportinstruction.pb.h"
 #include "fatal_assert.h"
+#include "dos_assert.h"
 
 using namespace Network;
 using namespace TransportBuffers;
@@ -57,7 +58,8 @@ string Fragment::tostring( void )
   assert( initialized );
 
   string ret;
-  
+  ret.reserve( frag_header_len + contents.size() );
+
   ret += network_order_string( id );
 
   fatal_assert( !( fragment_num & 0x8000 ) ); /* effective limit on size of a terminal screen change or buffered user input */
@@ -71,23 +73,45 @@ string Fragment::tostring( void )
   return ret;
 }
 
-Fragment::Fragment( string &x )
+Fragment::Fragment( const Slice & x )
   : id( -1 ), fragment_num( -1 ), final( false ), initialized( true ),
-    contents( x.begin() + frag_header_len, x.end() )
+    contents(), received()
 {
-  assert( x.size() >= frag_header_len );
+  dos_assert( x.size() >= frag_header_len );
+  received = x.substr( frag_header_len );
 
   uint64_t data64;
-  uint16_t *data16 = (uint16_t *)x.data();
+  uint16_t data16;
   memcpy( &data64, x.data(), sizeof( data64 ) );
+  memcpy( &data16, x.data() + sizeof( data64 ), sizeof( data16 ) );
   id = be64toh( data64 );
-  fragment_num = be16toh( data16[ 4 ] );
+  fragment_num = be16toh( data16 );
   final = ( fragment_num & 0x8000 ) >> 15;
   fragment_num &= 0x7FFF;
 }
 
+void Fragment::keep( void )
+{
+  if ( received.data() ) {
+    contents.assign( received.data(), received.size() );
+    received = Slice();
+  }
+}
+
 bool FragmentAssembly::add_fragment( Fragment &frag )
 {
+  /* a whole instruction needs nothing kept */
+  if ( frag.fragment_num == 0 && frag.final && frag.received.data() ) {
+    fragments.clear();
+    current_id = frag.id;
+    fragments_arrived = fragments_total = 1;
+    single = frag.received;
+    return true;
+  }
+
+  frag.keep();
+  single = Slice();
+
   /* see if this is a totally new packet */
   if ( current_id != frag.id ) {
     fragments.clear();
@@ -129,6 +153,17 @@ Instruction FragmentAssembly::get_assembly( void )
 {
   assert( fragments_arrived == fragments_total );
 
+  if ( single.data() ) {
+    Instruction ret;
+    fatal_assert( ret.ParseFromArray( single.data(), single.size() ) );
+
+    single = Slice();
+    fragments_arrived = 0;
+    fragments_total = -1;
+
+    return ret;
+  }
+
   string encoded;
 
   for ( int i = 0; i < fragments_total; i++ ) {
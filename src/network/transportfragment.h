@@ -38,6 +38,7 @@
 #include <string>
 
 #include "transportinstruction.pb.h"
+#include "slice.h"
 
 using std::vector;
 using std::string;
@@ -60,16 +61,24 @@ namespace Network {
 
     string contents;
 
+    /* The contents of a fragment just received, left in the receive
+       buffer instead of contents until they have to be kept. */
+    Slice received;
+
     Fragment()
-      : id( -1 ), fragment_num( -1 ), final( false ), initialized( false ), contents()
+      : id( -1 ), fragment_num( -1 ), final( false ), initialized( false ), contents(), received()
     {}
 
     Fragment( uint64_t s_id, uint16_t s_fragment_num, bool s_final, string s_contents )
       : id( s_id ), fragment_num( s_fragment_num ), final( s_final ), initialized( true ),
-	contents( s_contents )
+	contents( s_contents ), received()
     {}
 
-    Fragment( string &x );
+    /* a view of x, which must outlive it or be kept() first */
+    Fragment( const Slice & x );
+
+    /* copies any received contents into contents */
+    void keep( void );
 
     string tostring( void );
 
@@ -83,8 +92,12 @@ namespace Network {
     uint64_t current_id;
     int fragments_arrived, fragments_total;
 
+    /* an instruction that came in one fragment, decoded from where it
+       was received */
+    Slice single;
+
   public:
-    FragmentAssembly() : fragments(), current_id( -1 ), fragments_arrived( 0 ), fragments_total( -1 ) {}
+    FragmentAssembly() : fragments(), current_id( -1 ), fragments_arrived( 0 ), fragments_total( -1 ), single() {}
     bool add_fragment( Fragment &inst );
     Instruction get_assembly( void );
   };
@@ -0,0 +1,151 @@
+#ifndef BINLOOPS_HH
+#define BINLOOPS_HH
+
+#include <type_traits>
+
+/* Loops over every bin of a distribution, with the bin count fixed at
+   compile time for the usual sizes (128, 256 or 512 bins plus the zero
+   bin) and taken at run time otherwise. The fixed-size copies get
+   constant trip counts, so the compiler unrolls and vectorizes them
+   without remainder handling.
+
+   A kernel is a class with a result_type and a templated
+   operator()( Size n ), where Size is either unsigned int or a
+   std::integral_constant. */
+
+namespace BinLoops {
+  template <unsigned int N>
+  class Fixed : public std::integral_constant< unsigned int, N > {};
+
+  template <class Kernel>
+  typename Kernel::result_type dispatch( const unsigned int n, const Kernel & kernel )
+  {
+    switch ( n ) {
+    case 129: return kernel( Fixed< 129 >() );
+    case 257: return kernel( Fixed< 257 >() );
+    case 513: return kernel( Fixed< 513 >() );
+    default: return kernel( n );
+    }
+  }
+
+  /* sum of x, in order */
+  class Sum {
+  public:
+    typedef double result_type;
+    const double *x;
+
+    Sum( const double *s_x ) : x( s_x ) {}
+
+    template <class Size>
+    double operator()( const Size n ) const
+    {
+      double ret = 0.0;
+      for ( unsigned int i = 0; i < n; i++ ) {
+	ret += x[ i ];
+      }
+      return ret;
+    }
+  };
+
+  /* x /= divisor */
+  class Divide {
+  public:
+    typedef void result_type;
+    double *x;
+    double divisor;
+
+    Divide( double *s_x, const double s_divisor ) : x( s_x ), divisor( s_divisor ) {}
+
+    template <class Size>
+    void operator()( const Size n ) const
+    {
+      for ( unsigned int i = 0; i < n; i++ ) {
+	x[ i ] /= divisor;
+      }
+    }
+  };
+
+  /* x *= factor */
+  class Scale {
+  public:
+    typedef void result_type;
+    double *x;
+    double factor;
+
+    Scale( double *s_x, const double s_factor ) : x( s_x ), factor( s_factor ) {}
+
+    template <class Size>
+    void operator()( const Size n ) const
+    {
+      for ( unsigned int i = 0; i < n; i++ ) {
+	x[ i ] *= factor;
+      }
+    }
+  };
+
+  /* y += a * x */
+  class Axpy {
+  public:
+    typedef void result_type;
+    double a;
+    const double * __restrict__ x;
+    double * __restrict__ y;
+
+    Axpy( const double s_a, const double *s_x, double *s_y ) : a( s_a ), x( s_x ), y( s_y ) {}
+
+    template <class Size>
+    void operator()( const Size n ) const
+    {
+      for ( unsigned int i = 0; i < n; i++ ) {
+	y[ i ] += a * x[ i ];
+      }
+    }
+  };
+
+  /* out = x * y, elementwise; returns the sum of out, in order */
+  class Product {
+  public:
+    typedef double result_type;
+    const double * __restrict__ x;
+    const double * __restrict__ y;
+    double * __restrict__ out;
+
+    Product( const double *s_x, const double *s_y, double *s_out ) : x( s_x ), y( s_y ), out( s_out ) {}
+
+    template <class Size>
+    double operator()( const Size n ) const
+    {
+      for ( unsigned int i = 0; i < n; i++ ) {
+	out[ i ] = x[ i ] * y[ i ];
+      }
+
+      double ret = 0.0;
+      for ( unsigned int i = 0; i < n; i++ ) {
+	ret += out[ i ];
+      }
+      return ret;
+    }
+  };
+
+  /* sum of x * y, in order */
+  class Dot {
+  public:
+    typedef double result_type;
+    const double *x;
+    const double *y;
+
+    Dot( const double *s_x, const double *s_y ) : x( s_x ), y( s_y ) {}
+
+    template <class Size>
+    double operator()( const Size n ) const
+    {
+      double ret = 0.0;
+      for ( unsigned int i = 0; i < n; i++ ) {
+	ret += x[ i ] * y[ i ];
+      }
+      return ret;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <string.h>
+#include <tuple>
+
+#include "fastforward.hh"
+#include "sharedcache.hh"
+#include "binloops.hh"
+
+FastForward::FastForward( const double s_time, const TransitionKernel & kernel, const double *likelihood )
+  : _time( s_time ),
+    _powers()
+{
+  /* stored transposed (old x new), so applying one is a run of
+     contiguous multiply-adds */
+  const Matrix dense( kernel.dense() );
+  Matrix step( dense.cols(), dense.rows() );
+
+  for ( unsigned int i = 0; i < step.rows(); i++ ) {
+    double *row = step.row( i );
+    for ( unsigned int j = 0; j < step.cols(); j++ ) {
+      row[ j ] = dense( j, i ) * ( likelihood ? likelihood[ j ] : 1.0 );
+    }
+  }
+
+  _powers.push_back( step );
+  for ( unsigned int level = 1; level < LEVELS; level++ ) {
+    _powers.push_back( _powers.back() * _powers.back() );
+  }
+}
+
+double FastForward::apply( unsigned int ticks, double *pmf, double *scratch ) const
+{
+  const unsigned int n = size();
+  double mass = BinLoops::dispatch( n, BinLoops::Sum( pmf ) );
+
+  /* largest powers first; each product is renormalized so a long
+     run of unlikely ticks cannot underflow */
+  for ( int level = LEVELS - 1; level >= 0; level-- ) {
+    const unsigned int span = 1 << level;
+    while ( ticks >= span ) {
+      _powers[ level ].transpose_multiply( pmf, 0, n, scratch );
+      mass = BinLoops::dispatch( n, BinLoops::Sum( scratch ) );
+      if ( mass > 0 ) {
+	BinLoops::dispatch( n, BinLoops::Divide( scratch, mass ) );
+	mass = 1.0;
+      }
+      memcpy( pmf, scratch, n * sizeof( double ) );
+      ticks -= span;
+    }
+  }
+
+  return mass;
+}
+
+typedef std::tuple< unsigned int, double, double, double, double, double, bool > FastForwardKey;
+
+static SharedCache< FastForwardKey, FastForward > & fast_forward_cache( void )
+{
+  static SharedCache< FastForwardKey, FastForward > cache;
+  return cache;
+}
+
+std::shared_ptr< const FastForward > FastForward::get( const SampledFunction & geometry,
+						       const double time,
+						       const TransitionKernel & kernel,
+						       const double *likelihood )
+{
+  const FastForwardKey key( geometry.size(), geometry.offset(), geometry.bin_width(),
+			    kernel.stddev(), kernel.zero_escape_probability(), time, likelihood != NULL );
+
+  return fast_forward_cache().get( key, [&] () { return new FastForward( time, kernel, likelihood ); } );
+}
@@ -0,0 +1,42 @@
+#ifndef FASTFORWARD_HH
+#define FASTFORWARD_HH
+
+#include <vector>
+#include <memory>
+
+#include "matrix.hh"
+#include "transitionkernel.hh"
+
+/* Dense powers S^(2^m) of one idle tick, where S is the transition
+   kernel, optionally followed by the likelihood of zero arrivals.
+   A run of k idle ticks then costs one dense product per set bit of
+   k instead of k sparse ones. */
+
+class FastForward
+{
+public:
+  /* longest single product, in ticks, is 2^(LEVELS - 1) */
+  static const unsigned int LEVELS = 8;
+
+private:
+  const double _time;
+  std::vector< Matrix > _powers;
+
+public:
+  /* likelihood is NULL for ticks that only evolve */
+  FastForward( const double s_time, const TransitionKernel & kernel, const double *likelihood );
+
+  unsigned int size( void ) const { return _powers.front().rows(); }
+  bool matches( const double time ) const { return time == _time; }
+
+  /* advance pmf by ticks idle ticks, through scratch; returns its mass */
+  double apply( unsigned int ticks, double *pmf, double *scratch ) const;
+
+  /* shared by every Process with the same bins, parameters and tick length */
+  static std::shared_ptr< const FastForward > get( const SampledFunction & geometry,
+						   const double time,
+						   const TransitionKernel & kernel,
+						   const double *likelihood );
+};
+
+#endif
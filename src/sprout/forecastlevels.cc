@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+
+#include "forecastlevels.hh"
+
+unsigned int ForecastLevels::encode( const double quantile )
+{
+  return lrint( quantile * 10000 );
+}
+
+ForecastLevels::ForecastLevels( const double primary, const std::vector< double > & extra )
+  : _levels( extra ),
+    _primary( 0 )
+{
+  _levels.push_back( primary );
+
+  for ( auto it = _levels.begin(); it != _levels.end(); it++ ) {
+    if ( !( *it > 0 && *it < 1 ) ) {
+      fprintf( stderr, "Forecast quantile %g out of range.\n", *it );
+      exit( 1 );
+    }
+  }
+
+  /* levels that round to the same wire value are sent once */
+  std::sort( _levels.begin(), _levels.end() );
+  _levels.erase( std::unique( _levels.begin(), _levels.end(),
+			      [] ( const double a, const double b ) { return encode( a ) == encode( b ); } ),
+		 _levels.end() );
+
+  while ( encode( _levels[ _primary ] ) != encode( primary ) ) {
+    _primary++;
+  }
+}
+
+void ForecastLevels::fill( const std::vector< unsigned int > & counts, Sprout::DeliveryForecast & forecast ) const
+{
+  const unsigned int n = _levels.size();
+  const unsigned int intervals = counts.size() / n;
+
+  forecast.clear_counts();
+  forecast.clear_counts_level();
+  forecast.clear_quantile_levels();
+  forecast.clear_quantile_counts();
+
+  for ( unsigned int i = 0; i < intervals; i++ ) {
+    forecast.add_counts( counts[ i * n + _primary ] );
+  }
+
+  /* the level of counts goes whenever the sender couldn't assume it */
+  if ( encode( _levels[ _primary ] ) != DEFAULT_LEVEL ) {
+    forecast.set_counts_level( encode( _levels[ _primary ] ) );
+  }
+
+  if ( n == 1 ) {
+    return;
+  }
+
+  for ( unsigned int j = 0; j < n; j++ ) {
+    if ( j == _primary ) {
+      continue;
+    }
+
+    forecast.add_quantile_levels( encode( _levels[ j ] ) );
+
+    /* cumulative counts rise slowly, so the differences are one-byte varints */
+    int previous = 0;
+    for ( unsigned int i = 0; i < intervals; i++ ) {
+      forecast.add_quantile_counts( int( counts[ i * n + j ] ) - previous );
+      previous = counts[ i * n + j ];
+    }
+  }
+}
+
+double ForecastLevels::select( const Sprout::DeliveryForecast & forecast, const double quantile,
+			       std::vector< int > & out )
+{
+  const int want = encode( quantile );
+  const int intervals = forecast.counts_size();
+
+  int best = forecast.has_counts_level() ? forecast.counts_level() : DEFAULT_LEVEL;
+  int best_index = -1;
+
+  /* ignore further levels that don't match the counts */
+  if ( forecast.quantile_counts_size() == forecast.quantile_levels_size() * intervals ) {
+    for ( int j = 0; j < forecast.quantile_levels_size(); j++ ) {
+      const int level = forecast.quantile_levels( j );
+      if ( abs( level - want ) < abs( best - want )
+	   || ( abs( level - want ) == abs( best - want ) && level < best ) ) {
+	best = level;
+	best_index = j;
+      }
+    }
+  }
+
+  out.resize( intervals );
+  if ( best_index < 0 ) {
+    std::copy( forecast.counts().begin(), forecast.counts().end(), out.begin() );
+  } else {
+    int count = 0;
+    for ( int i = 0; i < intervals; i++ ) {
+      count += forecast.quantile_counts( best_index * intervals + i );
+      out[ i ] = count;
+    }
+  }
+
+  return best / 10000.0;
+}
@@ -0,0 +1,40 @@
+#ifndef FORECASTLEVELS_HH
+#define FORECASTLEVELS_HH
+
+#include <vector>
+
+#include "deliveryforecast.pb.h"
+
+/* The quantiles of cumulative deliveries a Receiver forecasts: the
+   one sent as counts, plus any further ones offered to the sender.
+   All are searched for in one pass and packed into the same
+   DeliveryForecast; the sender picks the level nearest its risk. */
+
+class ForecastLevels
+{
+private:
+  std::vector< double > _levels; /* increasing */
+  unsigned int _primary; /* index of the level sent as counts */
+
+public:
+  /* quantile as parts per 10000, as on the wire */
+  static unsigned int encode( const double quantile );
+
+  /* the level assumed for counts when none is sent */
+  static const unsigned int DEFAULT_LEVEL = 500;
+
+  ForecastLevels( const double primary, const std::vector< double > & extra );
+
+  const double *data( void ) const { return _levels.data(); }
+  unsigned int size( void ) const { return _levels.size(); }
+
+  /* counts[ interval * size() + j ] is the forecast at level j */
+  void fill( const std::vector< unsigned int > & counts, Sprout::DeliveryForecast & forecast ) const;
+
+  /* The counts at the level nearest the quantile (the lower of two
+     equally near); returns that level, as a fraction. */
+  static double select( const Sprout::DeliveryForecast & forecast, const double quantile,
+			std::vector< int > & out );
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <chrono>
+
+#include "forecastmodel.hh"
+#include "modelfile.hh"
+#include "sproutmath.pb.h"
+
+typedef std::shared_ptr< const std::vector< ProcessForecastInterval > > Intervals;
+typedef std::shared_ptr< const std::vector< BasicProcessForecastInterval< float > > > SingleIntervals;
+
+bool ModelParameters::operator<( const ModelParameters & other ) const
+{
+  return std::tie( max_arrival_rate, brownian_motion_rate, outage_escape_rate,
+		   num_bins, tick_length, max_arrivals_per_tick, num_ticks )
+    < std::tie( other.max_arrival_rate, other.brownian_motion_rate, other.outage_escape_rate,
+		other.num_bins, other.tick_length, other.max_arrivals_per_tick, other.num_ticks );
+}
+
+ForecastModel::ForecastModel( const ModelParameters & params, const std::string & filename_in )
+  : _double_once(),
+    _single_once(),
+    _fixed16_once(),
+    _intervals(),
+    _single(),
+    _fixed16(),
+    _read_single( false )
+{
+  if ( filename_in.empty() ) {
+    _intervals = compute( params );
+  } else if ( ModelFile::recognize( filename_in ) ) {
+    /* flat format: use the mapped tables in place */
+    std::shared_ptr< const ModelFile > file( ModelFile::get( filename_in ) );
+    if ( !( file->parameters() == params ) ) {
+      fprintf( stderr, "Warning: %s was built for different model parameters.\n", filename_in.c_str() );
+    }
+    if ( file->single_precision() ) {
+      _single = SingleIntervals( file, &file->single_intervals() );
+      _read_single = true;
+    } else {
+      _intervals = Intervals( file, &file->intervals() );
+    }
+  } else {
+    _intervals = read_protobuf( filename_in );
+  }
+
+  /* a model for other parameters still has to fit this Process */
+  if ( _read_single ) {
+    check( *_single, params );
+  } else {
+    check( *_intervals, params );
+  }
+}
+
+template <class Scalar>
+void ForecastModel::check( const std::vector< BasicProcessForecastInterval< Scalar > > & intervals,
+			   const ModelParameters & params )
+{
+  const unsigned int rows = Process( params.max_arrival_rate,
+				     params.brownian_motion_rate,
+				     params.outage_escape_rate,
+				     params.num_bins ).pmf().size();
+  if ( intervals.size() != size_t( params.num_ticks ) ) {
+    fprintf( stderr, "Model has %d intervals, expected %d.\n", int( intervals.size() ), params.num_ticks );
+    exit( 1 );
+  }
+  for ( auto it = intervals.begin(); it != intervals.end(); it++ ) {
+    if ( it->count_probability().rows() != rows ) {
+      fprintf( stderr, "Model has %u rate bins, expected %u.\n", it->count_probability().rows(), rows );
+      exit( 1 );
+    }
+  }
+}
+
+/* a copy of the tables at another precision */
+template <class Scalar, class Other>
+static std::shared_ptr< const std::vector< BasicProcessForecastInterval< Scalar > > >
+convert( const std::vector< BasicProcessForecastInterval< Other > > & intervals )
+{
+  auto ret = std::make_shared< std::vector< BasicProcessForecastInterval< Scalar > > >();
+  for ( auto it = intervals.begin(); it != intervals.end(); it++ ) {
+    ret->push_back( BasicProcessForecastInterval< Scalar >( *it ) );
+  }
+  return ret;
+}
+
+const std::vector< ProcessForecastInterval > & ForecastModel::intervals( void ) const
+{
+  std::call_once( _double_once, [&] () { if ( _read_single ) { _intervals = convert< double >( *_single ); } } );
+  return *_intervals;
+}
+
+const std::vector< BasicProcessForecastInterval< float > > & ForecastModel::single_intervals( void ) const
+{
+  std::call_once( _single_once, [&] () { if ( !_read_single ) { _single = convert< float >( *_intervals ); } } );
+  return *_single;
+}
+
+const std::vector< BasicProcessForecastInterval< Fixed16 > > & ForecastModel::fixed16_intervals( void ) const
+{
+  /* from the tables as read, not via a third copy */
+  std::call_once( _fixed16_once, [&] () {
+      _fixed16 = _read_single ? convert< Fixed16 >( single_intervals() ) : convert< Fixed16 >( intervals() );
+    } );
+  return *_fixed16;
+}
+
+template <class Scalar>
+static void search( const std::vector< BasicProcessForecastInterval< Scalar > > & intervals,
+		    const double *pmf, const double *quantiles, const unsigned int n,
+		    std::vector< unsigned int > & out )
+{
+  const EnsembleSupport support( pmf, intervals.front().count_probability().rows() );
+
+  /* deliveries are cumulative, so each quantile is at least the one
+     for the previous interval, and the search must reach the largest */
+  unsigned int hint = 0;
+  out.resize( intervals.size() * n );
+  for ( unsigned int i = 0; i < intervals.size(); i++ ) {
+    intervals[ i ].lower_quantiles( pmf, support, quantiles, n, &out[ i * n ], hint );
+    hint = out[ i * n + n - 1 ];
+  }
+}
+
+void ForecastModel::lower_quantiles( const double *pmf, const double *quantiles, const unsigned int n,
+				     const ForecastPrecision precision, std::vector< unsigned int > & out ) const
+{
+  switch ( precision ) {
+  case FORECAST_SINGLE: search( single_intervals(), pmf, quantiles, n, out ); break;
+  case FORECAST_FIXED16: search( fixed16_intervals(), pmf, quantiles, n, out ); break;
+  default: search( intervals(), pmf, quantiles, n, out ); break;
+  }
+}
+
+Intervals ForecastModel::compute( const ModelParameters & params )
+{
+  const Process example( params.max_arrival_rate,
+			 params.brownian_motion_rate,
+			 params.outage_escape_rate,
+			 params.num_bins );
+
+  fprintf( stderr, "Starting statistical calculations..." );
+  const auto start = std::chrono::steady_clock::now();
+
+  auto ret = std::make_shared< std::vector< ProcessForecastInterval > >(
+    ProcessForecastInterval::make_horizons( .001 * params.tick_length,
+					    example,
+					    params.max_arrivals_per_tick,
+					    params.num_ticks ) );
+
+  const std::chrono::duration< double > elapsed = std::chrono::steady_clock::now() - start;
+  fprintf( stderr, " done in %.3f s.\n", elapsed.count() );
+
+  return ret;
+}
+
+Intervals ForecastModel::read_protobuf( const std::string & filename )
+{
+  /* try to open */
+  int fd = open( filename.c_str(), O_RDONLY );
+  if ( fd < 0 ) {
+    fprintf( stderr, "Could not open %s.\n", filename.c_str() );
+    perror( "open" );
+    exit( 1 );
+  }
+
+  fprintf( stderr, "Reading model from %s...", filename.c_str() );
+
+  Sprout::SproutModel model;
+  if ( !model.ParseFromFileDescriptor( fd ) ) {
+    fprintf( stderr, "Could not parse %s.\n", filename.c_str() );
+    exit( 1 );
+  }
+
+  auto ret = std::make_shared< std::vector< ProcessForecastInterval > >();
+  for ( int i = 0; i < model.intervals_size(); i++ ) {
+    fprintf( stderr, "[tick %d", i );
+    ret->push_back( ProcessForecastInterval( model.intervals( i ) ) );
+    fprintf( stderr, "] " );
+  }
+  fprintf( stderr, " done.\n" );
+
+  if ( close( fd ) < 0 ) {
+    perror( "close" );
+    exit( 1 );
+  }
+
+  return ret;
+}
+
+void ForecastModel::write_protobuf( const std::string & filename,
+				    const std::vector< ProcessForecastInterval > & intervals )
+{
+  /* try to open */
+  int fd = open( filename.c_str(), O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR );
+  if ( fd < 0 ) {
+    fprintf( stderr, "Could not open %s.\n", filename.c_str() );
+    perror( "open" );
+    exit( 1 );
+  }
+
+  fprintf( stderr, "Writing model to %s...", filename.c_str() );
+
+  Sprout::SproutModel model;
+  for ( auto it = intervals.begin(); it != intervals.end(); it++ ) {
+    *model.add_intervals() = it->to_protobuf();
+  }
+
+  if ( !model.SerializeToFileDescriptor( fd ) ) {
+    fprintf( stderr, "Could not serialize model.\n" );
+    exit( 1 );
+  }
+
+  if ( close( fd ) < 0 ) {
+    perror( "close" );
+    exit( 1 );
+  }
+
+  fprintf( stderr, "done.\n" );
+}
+
+/* Unlike SharedCache, models are kept for the life of the process:
+   they are expensive to make and connections come and go. */
+
+std::shared_ptr< const ForecastModel > ForecastModel::get( const ModelParameters & params )
+{
+  typedef std::pair< ModelParameters, std::string > ModelKey;
+
+  static std::mutex mutex;
+  static std::map< ModelKey, std::shared_ptr< const ForecastModel > > models;
+
+  const char *filename_in = getenv( "SPROUT_MODEL_IN" );
+  const ModelKey key( params, filename_in ? filename_in : "" );
+
+  std::lock_guard< std::mutex > lock( mutex );
+
+  std::shared_ptr< const ForecastModel > & ret = models[ key ];
+  if ( !ret ) {
+    ret.reset( new ForecastModel( params, key.second ) );
+
+    const char *filename_out = getenv( "SPROUT_MODEL_OUT" );
+    if ( filename_out ) {
+      ret->write_protobuf( filename_out );
+    }
+  }
+
+  return ret;
+}
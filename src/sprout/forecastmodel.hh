@@ -0,0 +1,81 @@
+#ifndef FORECASTMODEL_HH
+#define FORECASTMODEL_HH
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "processforecaster.hh"
+
+/* everything the forecast tables depend on */
+class ModelParameters
+{
+public:
+  double max_arrival_rate;
+  double brownian_motion_rate;
+  double outage_escape_rate;
+  int num_bins;
+  int tick_length; /* ms */
+  int max_arrivals_per_tick;
+  int num_ticks;
+
+  bool operator<( const ModelParameters & other ) const;
+  bool operator==( const ModelParameters & other ) const { return !( *this < other ) && !( other < *this ); }
+};
+
+/* what the tables are read as when forecasting */
+enum ForecastPrecision { FORECAST_DOUBLE, FORECAST_SINGLE, FORECAST_FIXED16 };
+
+/* The interval forecasts for one set of parameters. Immutable, and
+   computed (or read from SPROUT_MODEL_IN) at most once per process;
+   every Receiver with the same parameters shares the same copy. */
+
+class ForecastModel
+{
+private:
+  /* The tables at each precision. Those computed or read are set from
+     the start (float ones only from a float32 model file); the rest
+     are converted from them on first use. */
+  mutable std::once_flag _double_once, _single_once, _fixed16_once;
+  mutable std::shared_ptr< const std::vector< ProcessForecastInterval > > _intervals;
+  mutable std::shared_ptr< const std::vector< BasicProcessForecastInterval< float > > > _single;
+  mutable std::shared_ptr< const std::vector< BasicProcessForecastInterval< Fixed16 > > > _fixed16;
+  bool _read_single; /* tables came as float */
+
+  ForecastModel( const ModelParameters & params, const std::string & filename_in );
+
+  /* exits unless the tables fit a Process with these parameters */
+  template <class Scalar>
+  static void check( const std::vector< BasicProcessForecastInterval< Scalar > > & intervals,
+		     const ModelParameters & params );
+
+  static std::shared_ptr< const std::vector< ProcessForecastInterval > > compute( const ModelParameters & params );
+  static std::shared_ptr< const std::vector< ProcessForecastInterval > > read_protobuf( const std::string & filename );
+
+public:
+  static std::shared_ptr< const ForecastModel > get( const ModelParameters & params );
+
+  const std::vector< ProcessForecastInterval > & intervals( void ) const;
+  const std::vector< BasicProcessForecastInterval< float > > & single_intervals( void ) const;
+  const std::vector< BasicProcessForecastInterval< Fixed16 > > & fixed16_intervals( void ) const;
+
+  /* the given quantile of deliveries over each interval, from a normalized pmf */
+  void lower_quantiles( const double *pmf, const double quantile, const ForecastPrecision precision,
+			std::vector< unsigned int > & out ) const
+  {
+    lower_quantiles( pmf, &quantile, 1, precision, out );
+  }
+
+  /* n increasing quantiles per interval, in one pass each;
+     out[ interval * n + j ] is quantile j */
+  void lower_quantiles( const double *pmf, const double *quantiles, const unsigned int n,
+			const ForecastPrecision precision, std::vector< unsigned int > & out ) const;
+
+  void write_protobuf( const std::string & filename ) const { write_protobuf( filename, intervals() ); }
+
+  static void write_protobuf( const std::string & filename,
+			      const std::vector< ProcessForecastInterval > & intervals );
+};
+
+#endif
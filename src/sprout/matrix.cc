@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+#include <algorithm>
+
+#include "matrix.hh"
+
+template <class Scalar>
+BasicMatrix< Scalar >::BasicMatrix( const unsigned int s_rows, const unsigned int s_cols )
+  : _rows( s_rows ),
+    _cols( s_cols ),
+    _stride( stride_for( s_cols ) ),
+    _data( NULL ),
+    _owner()
+{
+  allocate();
+  memset( static_cast< void * >( _data ), 0, _rows * _stride * sizeof( Scalar ) );
+}
+
+template <class Scalar>
+BasicMatrix< Scalar >::BasicMatrix( const unsigned int s_rows, const unsigned int s_cols,
+				    const Scalar *s_data, const std::shared_ptr< const void > & s_owner )
+  : _rows( s_rows ),
+    _cols( s_cols ),
+    _stride( stride_for( s_cols ) ),
+    _data( const_cast< Scalar * >( s_data ) ),
+    _owner( s_owner )
+{
+  assert( _owner );
+  assert( reinterpret_cast< uintptr_t >( _data ) % ALIGNMENT == 0 );
+}
+
+/* views share the underlying rows; owned matrices are copied */
+template <class Scalar>
+BasicMatrix< Scalar >::BasicMatrix( const BasicMatrix & other )
+  : _rows( other._rows ),
+    _cols( other._cols ),
+    _stride( other._stride ),
+    _data( other._data ),
+    _owner( other._owner )
+{
+  if ( !_owner ) {
+    allocate();
+    memcpy( static_cast< void * >( _data ), other._data, _rows * _stride * sizeof( Scalar ) );
+  }
+}
+
+template <class Scalar>
+BasicMatrix< Scalar > & BasicMatrix< Scalar >::operator=( const BasicMatrix & other )
+{
+  if ( this != &other ) {
+    if ( !_owner ) {
+      free( _data );
+    }
+    _rows = other._rows;
+    _cols = other._cols;
+    _stride = other._stride;
+    _data = other._data;
+    _owner = other._owner;
+    if ( !_owner ) {
+      allocate();
+      memcpy( static_cast< void * >( _data ), other._data, _rows * _stride * sizeof( Scalar ) );
+    }
+  }
+
+  return *this;
+}
+
+template <class Scalar>
+BasicMatrix< Scalar >::~BasicMatrix()
+{
+  if ( !_owner ) {
+    free( _data );
+  }
+}
+
+template <class Scalar>
+void BasicMatrix< Scalar >::swap( BasicMatrix & other )
+{
+  std::swap( _rows, other._rows );
+  std::swap( _cols, other._cols );
+  std::swap( _stride, other._stride );
+  std::swap( _data, other._data );
+  _owner.swap( other._owner );
+}
+
+template <class Scalar>
+unsigned int BasicMatrix< Scalar >::stride_for( const unsigned int cols )
+{
+  return ( ( cols * sizeof( Scalar ) + ALIGNMENT - 1 ) / ALIGNMENT ) * ALIGNMENT / sizeof( Scalar );
+}
+
+template <class Scalar>
+void BasicMatrix< Scalar >::allocate( void )
+{
+  void *ptr = NULL;
+  const size_t bytes = _rows * _stride * sizeof( Scalar );
+
+  if ( 0 != posix_memalign( &ptr, ALIGNMENT, bytes ? bytes : ALIGNMENT ) ) {
+    throw std::bad_alloc();
+  }
+
+  _data = static_cast< Scalar * >( ptr );
+}
+
+/* row i of the product accumulates other's rows, weighted by row i of
+   this, so the inner loop is a contiguous multiply-add */
+template <>
+Matrix Matrix::operator*( const Matrix & other ) const
+{
+  assert( _cols == other._rows );
+
+  Matrix ret( _rows, other._cols );
+
+  for ( unsigned int i = 0; i < _rows; i++ ) {
+    double *out = ret._data + i * ret._stride;
+    const double *this_row = row( i );
+    for ( unsigned int k = 0; k < _cols; k++ ) {
+      const double weight = this_row[ k ];
+      if ( weight == 0.0 ) {
+	continue;
+      }
+      const double *other_row = other.row( k );
+      for ( unsigned int j = 0; j < ret._stride; j++ ) {
+	out[ j ] += weight * other_row[ j ];
+      }
+    }
+  }
+
+  return ret;
+}
+
+/* Each row is a contiguous multiply-add into out, which the compiler
+   vectorizes; rows are visited in order so every column is summed in
+   the same order as a plain dot product down the column. */
+
+template <class Scalar>
+void BasicMatrix< Scalar >::transpose_multiply( const double *x, const unsigned int first, const unsigned int width,
+						double *out ) const
+{
+  assert( first + width <= _cols );
+
+  for ( unsigned int c = 0; c < width; c++ ) {
+    out[ c ] = 0.0;
+  }
+
+  for ( unsigned int i = 0; i < _rows; i++ ) {
+    const double weight = x[ i ];
+    const Scalar *this_row = row( i ) + first;
+
+    for ( unsigned int c = 0; c < width; c++ ) {
+      out[ c ] += weight * double( this_row[ c ] );
+    }
+  }
+}
+
+template <class Scalar>
+void BasicMatrix< Scalar >::transpose_multiply( const double *x, const std::vector< unsigned int > & rows,
+						const unsigned int first, const unsigned int width,
+						double *out ) const
+{
+  assert( first + width <= _cols );
+
+  for ( unsigned int c = 0; c < width; c++ ) {
+    out[ c ] = 0.0;
+  }
+
+  for ( auto it = rows.begin(); it != rows.end(); it++ ) {
+    const double weight = x[ *it ];
+    const Scalar *this_row = row( *it ) + first;
+
+    for ( unsigned int c = 0; c < width; c++ ) {
+      out[ c ] += weight * double( this_row[ c ] );
+    }
+  }
+}
+
+template class BasicMatrix< double >;
+template class BasicMatrix< float >;
+template class BasicMatrix< Fixed16 >;
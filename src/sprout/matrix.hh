@@ -0,0 +1,101 @@
+#ifndef MATRIX_HH
+#define MATRIX_HH
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <assert.h>
+
+/* A probability in [ 0, 1 ), stored in 16 bits as a multiple of 2^-16 */
+class Fixed16
+{
+private:
+  uint16_t _bits;
+
+public:
+  Fixed16( void ) : _bits( 0 ) {}
+  Fixed16( const double x ) : _bits( x <= 0 ? 0 : ( x * 65536.0 >= 65535 ? 65535 : uint16_t( x * 65536.0 + 0.5 ) ) ) {}
+
+  operator double( void ) const { return _bits * ( 1.0 / 65536.0 ); }
+};
+
+/* Dense row-major matrix in one 64-byte-aligned allocation. Each row
+   is padded with zeros to a whole number of cache lines.
+
+   A matrix can also be a read-only view of rows laid out the same way
+   elsewhere (e.g. in a mapped model file), kept alive by an owner.
+
+   The inference works in double; read-only tables can also be held
+   as float or Fixed16, to cut the memory traffic of forecasting.
+   Products accumulate in double whatever the storage. */
+
+template <class Scalar>
+class BasicMatrix
+{
+public:
+  static const unsigned int ALIGNMENT = 64;
+
+private:
+  unsigned int _rows, _cols, _stride;
+  Scalar *_data;
+  std::shared_ptr< const void > _owner; /* non-null for a view */
+
+  void allocate( void );
+
+public:
+  BasicMatrix( const unsigned int s_rows, const unsigned int s_cols );
+  BasicMatrix( const unsigned int s_rows, const unsigned int s_cols,
+	       const Scalar *s_data, const std::shared_ptr< const void > & s_owner );
+  BasicMatrix( const BasicMatrix & other );
+  BasicMatrix & operator=( const BasicMatrix & other );
+  ~BasicMatrix();
+
+  /* an owned copy, rounded to this scalar type */
+  template <class Other>
+  explicit BasicMatrix( const BasicMatrix< Other > & other )
+    : _rows( other.rows() ), _cols( other.cols() ), _stride( stride_for( _cols ) ), _data( NULL ), _owner()
+  {
+    /* strides differ with the scalar size, so only the columns are
+       read; the padding is zeroed */
+    allocate();
+    for ( unsigned int i = 0; i < _rows; i++ ) {
+      for ( unsigned int j = 0; j < _stride; j++ ) {
+	row( i )[ j ] = ( j < _cols ) ? Scalar( double( other.row( i )[ j ] ) ) : Scalar();
+      }
+    }
+  }
+
+  /* exchange contents without copying */
+  void swap( BasicMatrix & other );
+
+  unsigned int rows( void ) const { return _rows; }
+  unsigned int cols( void ) const { return _cols; }
+  unsigned int stride( void ) const { return _stride; }
+  bool is_view( void ) const { return bool( _owner ); }
+
+  static unsigned int stride_for( const unsigned int cols );
+
+  Scalar * row( const unsigned int i ) { assert( !_owner ); assert( i < _rows ); return _data + i * _stride; }
+  const Scalar * row( const unsigned int i ) const { assert( i < _rows ); return _data + i * _stride; }
+
+  Scalar & operator()( const unsigned int i, const unsigned int j ) { assert( j < _cols ); return row( i )[ j ]; }
+  const Scalar & operator()( const unsigned int i, const unsigned int j ) const { assert( j < _cols ); return row( i )[ j ]; }
+
+  /* this * other (double only) */
+  BasicMatrix operator*( const BasicMatrix & other ) const;
+
+  /* out[ c ] = sum over rows i of x[ i ] * M( i, first + c ), for c < width */
+  void transpose_multiply( const double *x, const unsigned int first, const unsigned int width,
+			   double *out ) const;
+
+  /* the same, summing only over the listed rows */
+  void transpose_multiply( const double *x, const std::vector< unsigned int > & rows,
+			   const unsigned int first, const unsigned int width,
+			   double *out ) const;
+};
+
+typedef BasicMatrix< double > Matrix;
+
+template <> Matrix Matrix::operator*( const Matrix & other ) const;
+
+#endif
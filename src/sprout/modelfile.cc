@@ -0,0 +1,294 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "modelfile.hh"
+#include "sharedcache.hh"
+
+const char ModelFile::MAGIC[ 8 ] = { 'S', 'P', 'R', 'T', 'M', 'O', 'D', 'L' };
+
+static_assert( sizeof( ModelFile::Header ) == 64, "model header must be one cache line" );
+static_assert( sizeof( ModelFile::Parameters ) == 64, "model parameters must be one cache line" );
+static_assert( sizeof( ModelFile::Table ) == 16, "model table must be packed" );
+
+static void fail( const std::string & filename, const char *problem )
+{
+  fprintf( stderr, "Bad model file %s: %s.\n", filename.c_str(), problem );
+  exit( 1 );
+}
+
+static uint64_t align( const uint64_t offset )
+{
+  return ( ( offset + Matrix::ALIGNMENT - 1 ) / Matrix::ALIGNMENT ) * Matrix::ALIGNMENT;
+}
+
+/* read-only mapping of a whole file */
+class ModelFile::Mapping
+{
+public:
+  const char *base;
+  size_t size;
+
+  Mapping( const std::string & filename )
+    : base( NULL ), size( 0 )
+  {
+    int fd = open( filename.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+      fprintf( stderr, "Could not open %s.\n", filename.c_str() );
+      perror( "open" );
+      exit( 1 );
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) < 0 ) {
+      perror( "fstat" );
+      exit( 1 );
+    }
+    size = st.st_size;
+
+    if ( size < sizeof( Header ) ) {
+      fail( filename, "truncated header" );
+    }
+
+    void *ptr = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+    if ( ptr == MAP_FAILED ) {
+      perror( "mmap" );
+      exit( 1 );
+    }
+    base = static_cast< const char * >( ptr );
+
+    if ( close( fd ) < 0 ) {
+      perror( "close" );
+      exit( 1 );
+    }
+  }
+
+  ~Mapping()
+  {
+    if ( munmap( const_cast< char * >( base ), size ) < 0 ) {
+      perror( "munmap" );
+    }
+  }
+
+  /* not implemented */
+  Mapping( const Mapping & );
+  Mapping & operator=( const Mapping & );
+};
+
+ModelFile::ModelFile( const std::string & filename )
+  : _mapping( std::make_shared< Mapping >( filename ) ),
+    _intervals(),
+    _single_intervals(),
+    _single_precision( false ),
+    _parameters(),
+    _quantile( 0 )
+{
+  const char *base = _mapping->base;
+  const Header *header = reinterpret_cast< const Header * >( base );
+
+  if ( memcmp( header->magic, MAGIC, sizeof( MAGIC ) ) ) {
+    fail( filename, "wrong magic number" );
+  }
+  if ( header->version != VERSION ) {
+    fail( filename, "unsupported version" );
+  }
+  if ( header->byte_order != BYTE_ORDER_MARK ) {
+    fail( filename, "written with a different byte order" );
+  }
+  if ( header->scalar_size != sizeof( double ) && header->scalar_size != sizeof( float ) ) {
+    fail( filename, "unsupported scalar size" );
+  }
+  if ( header->file_size != _mapping->size ) {
+    fail( filename, "wrong length" );
+  }
+  _single_precision = ( header->scalar_size == sizeof( float ) );
+
+  const uint64_t tables_end = sizeof( Header ) + sizeof( Parameters )
+    + uint64_t( header->num_intervals ) * sizeof( Table );
+  if ( tables_end > _mapping->size ) {
+    fail( filename, "truncated table directory" );
+  }
+
+  const uLong crc = crc32( crc32( 0, Z_NULL, 0 ),
+			   reinterpret_cast< const Bytef * >( base + sizeof( Header ) ),
+			   _mapping->size - sizeof( Header ) );
+  if ( crc != header->crc ) {
+    fail( filename, "checksum mismatch" );
+  }
+
+  const Parameters *parameters = reinterpret_cast< const Parameters * >( base + sizeof( Header ) );
+  _parameters.max_arrival_rate = parameters->max_arrival_rate;
+  _parameters.brownian_motion_rate = parameters->brownian_motion_rate;
+  _parameters.outage_escape_rate = parameters->outage_escape_rate;
+  _parameters.num_bins = parameters->num_bins;
+  _parameters.tick_length = parameters->tick_length;
+  _parameters.max_arrivals_per_tick = parameters->max_arrivals_per_tick;
+  _parameters.num_ticks = parameters->num_ticks;
+  _quantile = parameters->quantile;
+
+  if ( _parameters.num_ticks != int( header->num_intervals ) ) {
+    fail( filename, "parameters disagree with contents" );
+  }
+
+  const Table *tables = reinterpret_cast< const Table * >( base + sizeof( Header ) + sizeof( Parameters ) );
+  for ( unsigned int i = 0; i < header->num_intervals; i++ ) {
+    const Table & table = tables[ i ];
+
+    if ( table.offset % Matrix::ALIGNMENT
+	 || table.stride < table.cols
+	 || table.offset + uint64_t( header->rows ) * table.stride * header->scalar_size > _mapping->size ) {
+      fail( filename, "bad table" );
+    }
+
+    /* use the mapped rows in place */
+    if ( header->scalar_size == sizeof( double ) ) {
+      if ( table.stride != Matrix::stride_for( table.cols ) ) {
+	fail( filename, "bad row stride" );
+      }
+
+      _intervals.push_back( Matrix( header->rows, table.cols,
+				    reinterpret_cast< const double * >( base + table.offset ),
+				    _mapping ) );
+    } else {
+      if ( table.stride != BasicMatrix< float >::stride_for( table.cols ) ) {
+	fail( filename, "bad row stride" );
+      }
+
+      _single_intervals.push_back( BasicMatrix< float >( header->rows, table.cols,
+							  reinterpret_cast< const float * >( base + table.offset ),
+							  _mapping ) );
+    }
+  }
+}
+
+bool ModelFile::recognize( const std::string & filename )
+{
+  int fd = open( filename.c_str(), O_RDONLY );
+  if ( fd < 0 ) {
+    return false;
+  }
+
+  char magic[ sizeof( MAGIC ) ];
+  const bool ret = ( read( fd, magic, sizeof( magic ) ) == sizeof( magic ) )
+    && !memcmp( magic, MAGIC, sizeof( MAGIC ) );
+
+  if ( close( fd ) < 0 ) {
+    perror( "close" );
+    exit( 1 );
+  }
+
+  return ret;
+}
+
+static SharedCache< std::string, ModelFile > & model_file_cache( void )
+{
+  static SharedCache< std::string, ModelFile > cache;
+  return cache;
+}
+
+std::shared_ptr< const ModelFile > ModelFile::get( const std::string & filename )
+{
+  return model_file_cache().get( filename, [&] () { return new ModelFile( filename ); } );
+}
+
+template <class Scalar>
+static void write_rows( const Matrix & matrix, const unsigned int stride, char *out )
+{
+  Scalar *dest = reinterpret_cast< Scalar * >( out );
+  for ( unsigned int row = 0; row < matrix.rows(); row++ ) {
+    const double *source = matrix.row( row );
+    for ( unsigned int col = 0; col < matrix.cols(); col++ ) {
+      dest[ row * stride + col ] = source[ col ];
+    }
+  }
+}
+
+void ModelFile::write( const std::string & filename,
+		       const std::vector< ProcessForecastInterval > & intervals,
+		       const ModelParameters & parameters,
+		       const double quantile,
+		       const bool single_precision )
+{
+  const unsigned int scalar_size = single_precision ? sizeof( float ) : sizeof( double );
+  const unsigned int rows = intervals.empty() ? 0 : intervals.front().count_probability().rows();
+
+  /* lay out the tables */
+  std::vector< Table > tables( intervals.size() );
+  uint64_t file_size = sizeof( Header ) + sizeof( Parameters ) + tables.size() * sizeof( Table );
+  for ( unsigned int i = 0; i < intervals.size(); i++ ) {
+    const Matrix & matrix = intervals[ i ].count_probability();
+    assert( matrix.rows() == rows );
+
+    tables[ i ].offset = align( file_size );
+    tables[ i ].cols = matrix.cols();
+    tables[ i ].stride = align( matrix.cols() * scalar_size ) / scalar_size;
+    file_size = tables[ i ].offset + uint64_t( rows ) * tables[ i ].stride * scalar_size;
+  }
+
+  /* zero-filled, so padding is deterministic */
+  std::vector< char > contents( file_size, 0 );
+
+  Parameters stored;
+  memset( &stored, 0, sizeof( stored ) );
+  stored.max_arrival_rate = parameters.max_arrival_rate;
+  stored.brownian_motion_rate = parameters.brownian_motion_rate;
+  stored.outage_escape_rate = parameters.outage_escape_rate;
+  stored.quantile = quantile;
+  stored.num_bins = parameters.num_bins;
+  stored.tick_length = parameters.tick_length;
+  stored.max_arrivals_per_tick = parameters.max_arrivals_per_tick;
+  stored.num_ticks = parameters.num_ticks;
+  assert( stored.num_ticks == intervals.size() );
+
+  memcpy( &contents[ sizeof( Header ) ], &stored, sizeof( stored ) );
+  memcpy( &contents[ sizeof( Header ) + sizeof( Parameters ) ], tables.data(), tables.size() * sizeof( Table ) );
+  for ( unsigned int i = 0; i < intervals.size(); i++ ) {
+    if ( single_precision ) {
+      write_rows< float >( intervals[ i ].count_probability(), tables[ i ].stride, &contents[ tables[ i ].offset ] );
+    } else {
+      write_rows< double >( intervals[ i ].count_probability(), tables[ i ].stride, &contents[ tables[ i ].offset ] );
+    }
+  }
+
+  Header header;
+  memset( &header, 0, sizeof( header ) );
+  memcpy( header.magic, MAGIC, sizeof( MAGIC ) );
+  header.version = VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.scalar_size = scalar_size;
+  header.num_intervals = intervals.size();
+  header.rows = rows;
+  header.file_size = file_size;
+  header.crc = crc32( crc32( 0, Z_NULL, 0 ),
+		      reinterpret_cast< const Bytef * >( &contents[ sizeof( Header ) ] ),
+		      file_size - sizeof( Header ) );
+  memcpy( &contents[ 0 ], &header, sizeof( header ) );
+
+  int fd = open( filename.c_str(), O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR );
+  if ( fd < 0 ) {
+    fprintf( stderr, "Could not open %s.\n", filename.c_str() );
+    perror( "open" );
+    exit( 1 );
+  }
+
+  for ( size_t done = 0; done < contents.size(); ) {
+    const ssize_t bytes = ::write( fd, &contents[ done ], contents.size() - done );
+    if ( bytes < 0 ) {
+      perror( "write" );
+      exit( 1 );
+    }
+    done += bytes;
+  }
+
+  if ( close( fd ) < 0 ) {
+    perror( "close" );
+    exit( 1 );
+  }
+}
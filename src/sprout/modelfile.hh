@@ -0,0 +1,99 @@
+#ifndef MODELFILE_HH
+#define MODELFILE_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "processforecaster.hh"
+#include "forecastmodel.hh"
+
+/* Flat binary forecast model, mapped read-only and shared by every
+   Receiver in the process.
+
+   Layout, in native byte order:
+     Header       64 bytes
+     Parameters   64 bytes, what the model was built with
+     Table        one per interval
+     matrices     each 64-byte aligned, rows x stride scalars, row-major,
+                  every row zero-padded past cols (as in Matrix)
+
+   The CRC-32 covers everything after the header. Matrices are used in
+   place, as double or float tables according to the scalar size;
+   reading them at another precision makes a copy (see ForecastModel). */
+
+class ModelFile
+{
+public:
+  struct Header {
+    char magic[ 8 ];
+    uint32_t version;
+    uint32_t byte_order; /* BYTE_ORDER_MARK as written */
+    uint32_t scalar_size; /* 8 or 4 */
+    uint32_t num_intervals;
+    uint32_t rows;
+    uint32_t crc;
+    uint64_t file_size;
+    char reserved[ 24 ];
+  };
+
+  struct Parameters {
+    double max_arrival_rate;
+    double brownian_motion_rate;
+    double outage_escape_rate;
+    double quantile;
+    uint32_t num_bins;
+    uint32_t tick_length;
+    uint32_t max_arrivals_per_tick;
+    uint32_t num_ticks;
+    char reserved[ 16 ];
+  };
+
+  struct Table {
+    uint64_t offset;
+    uint32_t cols;
+    uint32_t stride; /* in scalars */
+  };
+
+  static const char MAGIC[ 8 ];
+  static const uint32_t VERSION = 2;
+  static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+private:
+  class Mapping;
+
+  std::shared_ptr< const Mapping > _mapping;
+  std::vector< ProcessForecastInterval > _intervals;
+  std::vector< BasicProcessForecastInterval< float > > _single_intervals;
+  bool _single_precision;
+  ModelParameters _parameters;
+  double _quantile;
+
+  ModelFile( const std::string & filename );
+
+public:
+  /* true if the file starts with the flat-format magic number */
+  static bool recognize( const std::string & filename );
+
+  /* map and check the file, or return the copy already mapped */
+  static std::shared_ptr< const ModelFile > get( const std::string & filename );
+
+  static void write( const std::string & filename,
+		     const std::vector< ProcessForecastInterval > & intervals,
+		     const ModelParameters & parameters,
+		     const double quantile,
+		     const bool single_precision = false );
+
+  /* views of the mapped tables; only the one for the stored scalar
+     size is filled in, and the other is empty */
+  const std::vector< ProcessForecastInterval > & intervals( void ) const { return _intervals; }
+  const std::vector< BasicProcessForecastInterval< float > > & single_intervals( void ) const { return _single_intervals; }
+  bool single_precision( void ) const { return _single_precision; }
+  const ModelParameters & parameters( void ) const { return _parameters; }
+
+  /* the forecast quantile the model was made for */
+  double quantile( void ) const { return _quantile; }
+};
+
+#endif
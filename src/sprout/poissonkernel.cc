@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <math.h>
+#include <tuple>
+#include <limits>
+#include <algorithm>
+
+#include "poissonkernel.hh"
+#include "sharedcache.hh"
+#include "binloops.hh"
+
+const std::vector< double > & PoissonKernel::log_factorials( void )
+{
+  static const std::vector< double > table = [] () {
+    std::vector< double > ret( PRECOMPUTED_COUNTS );
+    for ( int k = 0; k < PRECOMPUTED_COUNTS; k++ ) {
+      ret[ k ] = lgamma( k + 1.0 );
+    }
+    return ret;
+  } ();
+
+  return table;
+}
+
+double PoissonKernel::log_factorial( const int k )
+{
+  assert( k >= 0 );
+
+  if ( k < PRECOMPUTED_COUNTS ) {
+    return log_factorials()[ k ];
+  }
+
+  return lgamma( k + 1.0 );
+}
+
+PoissonKernel::PoissonKernel( const SampledFunction & geometry, const double s_time )
+  : _time( s_time ),
+    _rates( geometry.size() ),
+    _log_rates( geometry.size() ),
+    _table( PRECOMPUTED_COUNTS * geometry.size() )
+{
+  geometry.for_each( [&] ( const double midpoint, const double &, const unsigned int index )
+		     {
+		       _rates[ index ] = midpoint * _time;
+		       _log_rates[ index ] = log( _rates[ index ] );
+		     } );
+
+  for ( int k = 0; k < PRECOMPUTED_COUNTS; k++ ) {
+    evaluate( k, _table.data() + k * _rates.size() );
+  }
+}
+
+void PoissonKernel::evaluate( const int counts, double *out ) const
+{
+  assert( counts >= 0 );
+
+  const double k = counts;
+  const double log_k_factorial = log_factorial( counts );
+  const double *rates = _rates.data();
+  const double *log_rates = _log_rates.data();
+  const unsigned int n = _rates.size();
+
+  for ( unsigned int i = 0; i < n; i++ ) {
+    out[ i ] = exp( k * log_rates[ i ] - rates[ i ] - log_k_factorial );
+  }
+
+  /* a zero rate only ever produces zero arrivals */
+  for ( unsigned int i = 0; i < n; i++ ) {
+    if ( rates[ i ] == 0 ) {
+      out[ i ] = ( counts == 0 );
+    }
+  }
+}
+
+double PoissonKernel::multiply( const int counts, const double *pmf, double *out ) const
+{
+  assert( pmf != out );
+
+  const double *likelihood = row( counts );
+  std::vector< double > computed;
+
+  if ( !likelihood ) {
+    computed.resize( _rates.size() );
+    evaluate( counts, computed.data() );
+    likelihood = computed.data();
+  }
+
+  return BinLoops::dispatch( _rates.size(), BinLoops::Product( pmf, likelihood, out ) );
+}
+
+double PoissonKernel::multiply_log( const int counts, const double *pmf, double *out ) const
+{
+  assert( counts >= 0 );
+
+  const double k = counts;
+  const double log_k_factorial = log_factorial( counts );
+  const double minus_infinity = -std::numeric_limits< double >::infinity();
+  const unsigned int n = _rates.size();
+  double largest = minus_infinity;
+
+  for ( unsigned int i = 0; i < n; i++ ) {
+    double log_likelihood;
+    if ( _rates[ i ] == 0 ) {
+      log_likelihood = ( counts == 0 ) ? 0 : minus_infinity;
+    } else {
+      log_likelihood = k * _log_rates[ i ] - _rates[ i ] - log_k_factorial;
+    }
+
+    out[ i ] = ( pmf[ i ] > 0 ) ? log( pmf[ i ] ) + log_likelihood : minus_infinity;
+    largest = std::max( largest, out[ i ] );
+  }
+
+  if ( largest == minus_infinity ) {
+    std::fill( out, out + n, 0.0 );
+    return 0.0;
+  }
+
+  double sum = 0.0;
+  for ( unsigned int i = 0; i < n; i++ ) {
+    out[ i ] = exp( out[ i ] - largest );
+    sum += out[ i ];
+  }
+
+  return sum;
+}
+
+double PoissonKernel::expectation( const int counts, const double *pmf ) const
+{
+  const double *likelihood = row( counts );
+  std::vector< double > computed;
+
+  if ( !likelihood ) {
+    computed.resize( _rates.size() );
+    evaluate( counts, computed.data() );
+    likelihood = computed.data();
+  }
+
+  return BinLoops::dispatch( _rates.size(), BinLoops::Dot( pmf, likelihood ) );
+}
+
+typedef std::tuple< unsigned int, double, double, double > PoissonKey;
+
+static SharedCache< PoissonKey, PoissonKernel > & poisson_cache( void )
+{
+  static SharedCache< PoissonKey, PoissonKernel > cache;
+  return cache;
+}
+
+std::shared_ptr< const PoissonKernel > PoissonKernel::get( const SampledFunction & geometry, const double time )
+{
+  const PoissonKey key( geometry.size(), geometry.offset(), geometry.bin_width(), time );
+
+  return poisson_cache().get( key, [&] () { return new PoissonKernel( geometry, time ); } );
+}
@@ -0,0 +1,67 @@
+#ifndef POISSONKERNEL_HH
+#define POISSONKERNEL_HH
+
+#include <vector>
+#include <memory>
+
+#include "sampledfunction.hh"
+
+/* Poisson likelihood of a count at every bin of a SampledFunction,
+   for a fixed interval length. Evaluated in log space,
+
+     log P( k | lambda ) = k log lambda - lambda - lgamma( k + 1 ),
+
+   with the rows for small counts precomputed, so that Process::observe
+   and Process::count_probability are straight multiplies over the bins. */
+
+class PoissonKernel
+{
+public:
+  /* counts below this are looked up; larger ones are computed on demand */
+  static const int PRECOMPUTED_COUNTS = 64;
+
+private:
+  const double _time;
+  std::vector< double > _rates;
+  std::vector< double > _log_rates;
+  std::vector< double > _table; /* PRECOMPUTED_COUNTS rows of size() bins */
+
+  static const std::vector< double > & log_factorials( void );
+
+public:
+  PoissonKernel( const SampledFunction & geometry, const double s_time );
+
+  unsigned int size( void ) const { return _rates.size(); }
+  bool matches( const double time ) const { return time == _time; }
+
+  /* log( k! ), from a table for small k */
+  static double log_factorial( const int k );
+
+  /* likelihood of counts at every bin */
+  void evaluate( const int counts, double *out ) const;
+
+  /* out = pmf * likelihood of counts; returns the sum of out */
+  double multiply( const int counts, const double *pmf, double *out ) const;
+
+  /* The same product, formed in log space and scaled so the largest
+     bin is 1, for when the plain product underflows. Returns the sum
+     of out, or 0 if the counts are impossible wherever pmf is nonzero. */
+  double multiply_log( const int counts, const double *pmf, double *out ) const;
+
+  /* sum of pmf * likelihood of counts */
+  double expectation( const int counts, const double *pmf ) const;
+
+  /* precomputed row, or NULL if counts is out of range */
+  const double * row( const int counts ) const
+  {
+    if ( counts >= 0 && counts < PRECOMPUTED_COUNTS ) {
+      return _table.data() + counts * _rates.size();
+    }
+    return NULL;
+  }
+
+  /* shared by every Process with the same bins and tick length */
+  static std::shared_ptr< const PoissonKernel > get( const SampledFunction & geometry, const double time );
+};
+
+#endif
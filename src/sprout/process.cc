@@ -1,15 +1,25 @@
 #include <assert.h>
 #include <algorithm>
+#include <tuple>
 #include <boost/math/distributions/normal.hpp>
 
 #include "process.hh"
 #include "mypoisson.hh"
+#include "sharedcache.hh"
+#include "binloops.hh"
 
 using namespace boost::math;
 
 Process::Process( const double maximum_rate, const double s_brownian_motion_rate, const double s_outage_escape_rate, const int bins )
   : _probability_mass_function( bins, maximum_rate, 0 ),
+    _scratch( _probability_mass_function ),
+    _mass( _probability_mass_function.sum() ),
     _gaussian( maximum_rate, bins * 128 ),
+    _kernel(),
+    _kernel_time( -1 ),
+    _poisson(),
+    _fast_evolve(),
+    _fast_observe(),
     _brownian_motion_rate( s_brownian_motion_rate ),
     _outage_escape_rate( s_outage_escape_rate ),
     _normalized( false )
@@ -19,97 +29,145 @@ Process::Process( const double maximum_rate, const double s_brownian_motion_rate
 
 void Process::observe( const double time, const int counts )
 {
+  const PoissonKernel & kernel = poisson( time );
+
+  /* multiply by likelihood function, totalling as we go */
+  double mass = kernel.multiply( counts, _probability_mass_function.data(), _scratch.data() );
+
+  if ( !( mass >= RESCUE_BELOW ) ) {
+    /* underflowed (e.g. a burst after a long outage): redo it in log space */
+    mass = kernel.multiply_log( counts, _probability_mass_function.data(), _scratch.data() );
+
+    if ( mass == 0 ) {
+      /* impossible under every bin with mass; keep the prior rather than zeroing it */
+      return;
+    }
+  }
+
+  commit( mass );
+}
+
+void Process::commit( const double mass )
+{
+  _probability_mass_function.swap( _scratch );
+  _mass = mass;
   _normalized = false;
 
-  /* multiply by likelihood function */
-  _probability_mass_function.for_each( [&]
-				       ( const double midpoint, double & value, const unsigned int index __attribute((unused)) )
-				       {
-					 value *= poissonpdf( midpoint * time, counts );
-				       } );
+  if ( _mass < RESCALE_BELOW ) {
+    normalize();
+  }
 }
 
-void Process::normalize( void )
+void Process::tick( const double time, const int counts )
 {
-  if ( _normalized ) {
+  const PoissonKernel & likelihood = poisson( time );
+  const double *row = likelihood.row( counts );
+
+  if ( !row ) {
+    /* a count too large to be tabulated */
+    evolve( time );
+    observe( time, counts );
     return;
   }
 
-  double sum( 0 );
+  const double mass = kernel( time ).apply( _probability_mass_function.data(), row, _scratch.data() );
 
-  /* find the total */
-  _probability_mass_function.for_each( [&sum]
-				       ( const double, const double & value, const unsigned int )
-				       {
-					 sum += value;
-				       } );
+  if ( !( mass >= RESCUE_BELOW ) ) {
+    evolve( time );
+    observe( time, counts );
+    return;
+  }
 
-  /* normalize */
-  _probability_mass_function.for_each( [&sum]
-				       ( const double, double & value, const unsigned int )
-				       {
-					 value /= sum;
-				       } );
+  commit( mass );
+}
+
+void Process::fast_forward( const double time, const unsigned int ticks, const bool observe_zero )
+{
+  std::shared_ptr< const FastForward > & table = observe_zero ? _fast_observe : _fast_evolve;
+
+  if ( !table || !table->matches( time ) ) {
+    table = FastForward::get( _probability_mass_function, time, kernel( time ),
+			      observe_zero ? poisson( time ).row( 0 ) : NULL );
+  }
+
+  _mass = table->apply( ticks, _probability_mass_function.data(), _scratch.data() );
+  _normalized = false;
+
+  /* an idle tick is always possible at rate zero */
+  assert( _mass > 0 );
+}
+
+const PoissonKernel & Process::poisson( const double time )
+{
+  if ( !_poisson || !_poisson->matches( time ) ) {
+    _poisson = PoissonKernel::get( _probability_mass_function, time );
+  }
+
+  return *_poisson;
+}
 
+void Process::normalize( void )
+{
+  if ( _normalized ) {
+    return;
+  }
+
+  /* the total is already known from the last update */
+  BinLoops::dispatch( _probability_mass_function.size(),
+		      BinLoops::Divide( _probability_mass_function.data(), _mass ) );
+
+  _mass = 1.0;
   _normalized = true;
 }
 
-void Process::evolve( const double time )
+const TransitionKernel & Process::kernel( const double time )
 {
-  _normalized = false;
+  if ( _kernel && time == _kernel_time ) {
+    return *_kernel;
+  }
 
   /* initialize brownian motion */
-  double stddev = _brownian_motion_rate * sqrt( time );
-  _gaussian.calculate( stddev );
-
-  /* initialize new pmf */
-  SampledFunction new_pmf( _probability_mass_function );
-  new_pmf.for_each( [] ( const double, double & value, const unsigned int ) { value = 0; } );
+  const double stddev = _brownian_motion_rate * sqrt( time );
 
   const double zero_escape_probability = 1 - poissonpdf( time * _outage_escape_rate, 0 );
   assert( zero_escape_probability >= 0 );
   assert( zero_escape_probability <= 1.0 );
 
-  _probability_mass_function.for_each( [&]
-				       ( const double old_rate, const double & old_prob, const unsigned int old_index )
-				       {
-					 new_pmf.for_range( old_rate - 5 * stddev,
-							    old_rate + 5 * stddev,
-							    [&]
-							    ( const double new_rate, double & new_prob, const unsigned int new_index )
-							    {
-							      double zfactor = 1.0;
-							      
-							      if ( old_index == 0 ) {
-								zfactor = ( new_index != 0 ) ? zero_escape_probability : (1 - zero_escape_probability);
-							      }
-							      
-							      double contribution = zfactor * old_prob
-								* ( _gaussian.cdf( new_pmf.sample_ceil( new_rate ) - old_rate )
-								    - _gaussian.cdf( new_pmf.sample_floor( new_rate ) - old_rate ) );
-
-							      assert( !isnan( zfactor ) );
-							      assert( !isnan( old_prob ) );
-							      assert( !isnan( new_rate ) );
-							      assert( !isnan( old_rate ) );
-							      assert( !isnan( _gaussian.cdf( new_pmf.sample_ceil( new_rate ) - old_rate ) ) );
-							      assert( !isnan( _gaussian.cdf( new_pmf.sample_floor( new_rate ) - old_rate ) ) );
-
-							      assert( contribution >= 0.0 );
-							      assert( contribution <= 1.0 );
-
-							      new_prob += contribution;
-							    } );
-				       } );
-  
-  _probability_mass_function = new_pmf;
+  if ( !_kernel || !_kernel->matches( stddev, zero_escape_probability ) ) {
+    _kernel = TransitionKernel::get( _probability_mass_function, stddev, zero_escape_probability,
+				     [&] ( const double x ) {
+				       _gaussian.calculate( stddev );
+				       return _gaussian.cdf( x );
+				     } );
+  }
+  _kernel_time = time;
+
+  return *_kernel;
+}
+
+void Process::evolve( const double time )
+{
+  _normalized = false;
+
+  _mass = kernel( time ).apply( _probability_mass_function.data(), _scratch.data() );
+  _probability_mass_function.swap( _scratch );
 }
 
 Process::GaussianCache::GaussianCache( const double maximum_rate, const int bins )
-  : _cdf( bins, maximum_rate, -maximum_rate ),
-    _stddev( -1 )
+  : _maximum_rate( maximum_rate ),
+    _bins( bins ),
+    _stddev( -1 ),
+    _cdf()
 {}
 
+typedef std::tuple< double, int, double > GaussianKey;
+
+static SharedCache< GaussianKey, SampledFunction > & gaussian_cache( void )
+{
+  static SharedCache< GaussianKey, SampledFunction > cache;
+  return cache;
+}
+
 void Process::GaussianCache::calculate( const double s_stddev )
 {
   if ( s_stddev == _stddev ) {
@@ -117,9 +175,15 @@ void Process::GaussianCache::calculate( const double s_stddev )
   }
 
   _stddev = s_stddev;
-  normal diffdist( 0, _stddev );
 
-  _cdf.for_each( [&] ( const double x, double & value, const unsigned int ) { value = boost::math::cdf( diffdist, x ); } );
+  _cdf = gaussian_cache().get( GaussianKey( _maximum_rate, _bins, _stddev ), [&] () {
+      SampledFunction *table = new SampledFunction( _bins, _maximum_rate, -_maximum_rate );
+      normal diffdist( 0, _stddev );
+
+      table->for_each( [&] ( const double x, double & value, const unsigned int ) { value = boost::math::cdf( diffdist, x ); } );
+
+      return table;
+    } );
 }
 
 void Process::set_certain( const double rate )
@@ -139,15 +203,38 @@ void Process::set_certain( const double rate )
 					 }
 				       } );
 
+  _mass = 1.0;
   normalize();
 
   assert( _probability_mass_function[ rate ] == 1.0 );
 }
 
+Process::Process( const Process & other )
+  : _probability_mass_function( other._probability_mass_function ),
+    _scratch( other._scratch ),
+    _mass( other._mass ),
+    _gaussian( other._gaussian ),
+    _kernel( other._kernel ),
+    _kernel_time( other._kernel_time ),
+    _poisson( other._poisson ),
+    _fast_evolve( other._fast_evolve ),
+    _fast_observe( other._fast_observe ),
+    _brownian_motion_rate( other._brownian_motion_rate ),
+    _outage_escape_rate( other._outage_escape_rate ),
+    _normalized( other._normalized )
+{
+}
+
 Process & Process::operator=( const Process & other )
 {
   _probability_mass_function = other._probability_mass_function;
+  _mass = other._mass;
   _gaussian = other._gaussian;
+  _kernel = other._kernel;
+  _kernel_time = other._kernel_time;
+  _poisson = other._poisson;
+  _fast_evolve = other._fast_evolve;
+  _fast_observe = other._fast_observe;
   _normalized = other._normalized;
   *( const_cast< double * >( &_brownian_motion_rate ) ) = other._brownian_motion_rate;
 
@@ -156,14 +243,5 @@ Process & Process::operator=( const Process & other )
 
 double Process::count_probability( const double time, const int counts )
 {
-  double ret = 0.0;
-
-  _probability_mass_function.for_each( [&] ( const double rate,
-					     const double & rate_probability,
-					     const unsigned int )
-				       {
-					 ret += rate_probability * poissonpdf( rate * time, counts );
-				       } );
-
-  return ret;
+  return poisson( time ).expectation( counts, _probability_mass_function.data() );
 }
@@ -1,24 +1,52 @@
 #ifndef PROCESS_HPP
 #define PROCESS_HPP
 
+#include <memory>
+
 #include "sampledfunction.hh"
+#include "transitionkernel.hh"
+#include "poissonkernel.hh"
+#include "fastforward.hh"
 
 class Process
 {
+  friend class ProcessBatch; /* shares the kernels and thresholds */
+
 private:
+  /* read-only CDF table, shared by every GaussianCache with the same range, bins and stddev */
   class GaussianCache {
   private:
-    SampledFunction _cdf;
+    double _maximum_rate;
+    int _bins;
     double _stddev;
+    std::shared_ptr< const SampledFunction > _cdf;
 
   public:
     GaussianCache( const double maximum_rate, const int bins );
     void calculate( const double s_stddev );
-    double cdf( const double x ) const { return _cdf[ x ]; }
+    double cdf( const double x ) const { return (*_cdf)[ x ]; }
   };
 
   SampledFunction _probability_mass_function;
+  SampledFunction _scratch; /* the other half of a double buffer */
+  double _mass; /* sum of _probability_mass_function, kept by every update */
   GaussianCache _gaussian;
+  std::shared_ptr< const TransitionKernel > _kernel;
+  double _kernel_time;
+  std::shared_ptr< const PoissonKernel > _poisson;
+  std::shared_ptr< const FastForward > _fast_evolve, _fast_observe;
+
+  const TransitionKernel & kernel( const double time );
+  const PoissonKernel & poisson( const double time );
+
+  /* finish an update whose result (of the given mass) is in _scratch */
+  void commit( const double mass );
+
+  /* the pmf is rescaled at once if its mass falls below this... */
+  static constexpr double RESCALE_BELOW = 1e-100;
+
+  /* ...and an observation is redone in log space below this */
+  static constexpr double RESCUE_BELOW = 1e-280;
 
   const double _brownian_motion_rate; /* stddev of difference after one second */
   const double _outage_escape_rate; /* arrivals per second */
@@ -27,6 +55,7 @@ private:
 
 public:
   Process( const double maximum_rate, const double s_brownian_motion_rate, const double s_outage_escape_rate, const int bins );
+  Process( const Process & other );
 
   /* apply brownian motion */
   void evolve( const double time );
@@ -34,6 +63,13 @@ public:
   /* update from new observation */
   void observe( const double time, const int counts );
 
+  /* evolve, then observe, in one pass */
+  void tick( const double time, const int counts );
+
+  /* a run of ticks with nothing received: each evolves, and then
+     observes zero arrivals if observe_zero */
+  void fast_forward( const double time, const unsigned int ticks, const bool observe_zero );
+
   /* make pmf sum to unity */
   void normalize( void );
 
@@ -0,0 +1,203 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "processbatch.hh"
+#include "binloops.hh"
+
+/* the kernel works on whole blocks of columns */
+static unsigned int round_up( const unsigned int columns )
+{
+  const unsigned int block = TransitionKernel::BATCH_COLUMNS;
+  return ( ( columns + block - 1 ) / block ) * block;
+}
+
+ProcessBatch::ProcessBatch( const double maximum_rate, const double brownian_motion_rate,
+			    const double outage_escape_rate, const int bins, const unsigned int capacity )
+  : _prototype( maximum_rate, brownian_motion_rate, outage_escape_rate, bins ),
+    _pmfs( _prototype.pmf().size(), round_up( std::max( 1u, capacity ) ) ),
+    _scratch( _pmfs.rows(), _pmfs.cols() ),
+    _mass(),
+    _normalized(),
+    _size( 0 ),
+    _divisors(),
+    _likelihoods(),
+    _column( _pmfs.rows() ),
+    _rescued( _pmfs.rows() ),
+    _ones( _pmfs.rows(), 1.0 ),
+    _computed()
+{
+}
+
+void ProcessBatch::grow( void )
+{
+  Matrix bigger( _pmfs.rows(), 2 * _pmfs.cols() );
+  for ( unsigned int j = 0; j < _pmfs.rows(); j++ ) {
+    std::copy( _pmfs.row( j ), _pmfs.row( j ) + _size, bigger.row( j ) );
+  }
+
+  _pmfs.swap( bigger );
+  _scratch = Matrix( _pmfs.rows(), _pmfs.cols() );
+}
+
+unsigned int ProcessBatch::add( void )
+{
+  if ( _size == _pmfs.cols() ) {
+    grow();
+  }
+
+  const double *prior = _prototype.pmf().data();
+  for ( unsigned int j = 0; j < _pmfs.rows(); j++ ) {
+    _pmfs( j, _size ) = prior[ j ];
+  }
+  _mass.push_back( _prototype._mass );
+  _normalized.push_back( true );
+
+  return _size++;
+}
+
+void ProcessBatch::remove( const unsigned int column )
+{
+  assert( column < _size );
+
+  const unsigned int last = _size - 1;
+  for ( unsigned int j = 0; j < _pmfs.rows(); j++ ) {
+    _pmfs( j, column ) = _pmfs( j, last );
+  }
+  _mass[ column ] = _mass[ last ];
+  _normalized[ column ] = _normalized[ last ];
+
+  _mass.pop_back();
+  _normalized.pop_back();
+  _size--;
+}
+
+void ProcessBatch::tick( const double time, const std::vector< int > & counts )
+{
+  assert( counts.size() == _size );
+
+  const unsigned int n = _pmfs.rows();
+  const PoissonKernel & poisson = _prototype.poisson( time );
+
+  /* evolve every column into the scratch matrix, which keeps the
+     prior in case an observation needs to be redone */
+  _prototype.kernel( time ).apply( _pmfs, _size, _scratch );
+
+  /* each column's likelihood: a precomputed row, one evaluated here,
+     or ones where only evolving (an exact no-op) */
+  unsigned int large = 0;
+  for ( unsigned int c = 0; c < _size; c++ ) {
+    large += ( counts[ c ] >= 0 ) && !poisson.row( counts[ c ] );
+  }
+  _computed.resize( large * n );
+
+  _likelihoods.resize( _size );
+  large = 0;
+  for ( unsigned int c = 0; c < _size; c++ ) {
+    if ( counts[ c ] < 0 ) {
+      _likelihoods[ c ] = _ones.data();
+    } else if ( poisson.row( counts[ c ] ) ) {
+      _likelihoods[ c ] = poisson.row( counts[ c ] );
+    } else {
+      double *computed = _computed.data() + n * large++;
+      poisson.evaluate( counts[ c ], computed );
+      _likelihoods[ c ] = computed;
+    }
+  }
+
+  /* multiply, totalling each column in bin order */
+  std::fill( _mass.begin(), _mass.end(), 0.0 );
+  for ( unsigned int j = 0; j < n; j++ ) {
+    const double *evolved = _scratch.row( j );
+    double *out = _pmfs.row( j );
+    for ( unsigned int c = 0; c < _size; c++ ) {
+      out[ c ] = evolved[ c ] * _likelihoods[ c ][ j ];
+      _mass[ c ] += out[ c ];
+    }
+  }
+
+  for ( unsigned int c = 0; c < _size; c++ ) {
+    _normalized[ c ] = false;
+
+    if ( counts[ c ] < 0 ) {
+      continue;
+    }
+
+    if ( !( _mass[ c ] >= Process::RESCUE_BELOW ) ) {
+      rescue( poisson, c, counts[ c ] );
+    } else if ( _mass[ c ] < Process::RESCALE_BELOW ) {
+      normalize( c );
+    }
+  }
+}
+
+/* the observation underflowed: as Process::observe, redo it in log space */
+void ProcessBatch::rescue( const PoissonKernel & poisson, const unsigned int column, const int counts )
+{
+  const unsigned int n = _pmfs.rows();
+
+  for ( unsigned int j = 0; j < n; j++ ) {
+    _column[ j ] = _scratch( j, column );
+  }
+
+  const double mass = poisson.multiply_log( counts, _column.data(), _rescued.data() );
+
+  if ( mass == 0 ) {
+    /* impossible under every bin with mass; keep the evolved prior */
+    for ( unsigned int j = 0; j < n; j++ ) {
+      _pmfs( j, column ) = _column[ j ];
+    }
+    _mass[ column ] = BinLoops::dispatch( n, BinLoops::Sum( _column.data() ) );
+    return;
+  }
+
+  for ( unsigned int j = 0; j < n; j++ ) {
+    _pmfs( j, column ) = _rescued[ j ];
+  }
+  _mass[ column ] = mass;
+
+  if ( mass < Process::RESCALE_BELOW ) {
+    normalize( column );
+  }
+}
+
+void ProcessBatch::normalize_columns( const int only )
+{
+  const unsigned int n = _pmfs.rows();
+
+  if ( only >= 0 ) {
+    if ( !_normalized[ only ] ) {
+      for ( unsigned int j = 0; j < n; j++ ) {
+	_pmfs( j, only ) /= _mass[ only ];
+      }
+      _normalized[ only ] = true;
+    }
+    return;
+  }
+
+  /* dividing the columns already normalized by one leaves them as they are */
+  _divisors.resize( _size );
+  for ( unsigned int c = 0; c < _size; c++ ) {
+    _divisors[ c ] = _normalized[ c ] ? 1.0 : _mass[ c ];
+    _normalized[ c ] = true;
+  }
+
+  for ( unsigned int j = 0; j < n; j++ ) {
+    double *row = _pmfs.row( j );
+    for ( unsigned int c = 0; c < _size; c++ ) {
+      row[ c ] /= _divisors[ c ];
+    }
+  }
+}
+
+void ProcessBatch::pmfs( const unsigned int first, const unsigned int count, double *out ) const
+{
+  assert( first + count <= _size );
+
+  const unsigned int n = _pmfs.rows();
+  for ( unsigned int j = 0; j < n; j++ ) {
+    const double *row = _pmfs.row( j ) + first;
+    for ( unsigned int c = 0; c < count; c++ ) {
+      out[ c * n + j ] = row[ c ];
+    }
+  }
+}
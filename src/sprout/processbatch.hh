@@ -0,0 +1,64 @@
+#ifndef PROCESSBATCH_HH
+#define PROCESSBATCH_HH
+
+#include <vector>
+
+#include "process.hh"
+#include "matrix.hh"
+
+/* Many Processes with the same parameters, advanced together. The
+   pmfs are the columns of one bin x process matrix, so a tick is a
+   single product with the shared transition kernel, and every loop
+   runs across processes. Each column gets exactly the arithmetic of
+   Process::tick() and Process::evolve(). */
+
+class ProcessBatch
+{
+private:
+  Process _prototype; /* the prior for new columns, and the kernels */
+  Matrix _pmfs, _scratch; /* bin x process */
+  std::vector< double > _mass;
+  std::vector< char > _normalized;
+  unsigned int _size;
+
+  std::vector< double > _divisors; /* per column, for normalize() */
+  std::vector< const double * > _likelihoods; /* per column, for tick() */
+  std::vector< double > _column, _rescued, _ones, _computed;
+
+  void grow( void );
+  void normalize_columns( const int only );
+  void rescue( const PoissonKernel & poisson, const unsigned int column, const int counts );
+
+public:
+  ProcessBatch( const double maximum_rate, const double brownian_motion_rate, const double outage_escape_rate,
+		const int bins, const unsigned int capacity = 64 );
+
+  unsigned int size( void ) const { return _size; }
+  unsigned int bins( void ) const { return _pmfs.rows(); }
+
+  /* a new process with the uniform prior; returns its column */
+  unsigned int add( void );
+
+  /* drops a process; the last one moves into its column */
+  void remove( const unsigned int column );
+
+  /* one tick for every process: evolve, then observe counts[ column ]
+     arrivals, or only evolve where that is negative */
+  void tick( const double time, const std::vector< int > & counts );
+
+  /* make every pmf, or one, sum to unity */
+  void normalize( void ) { normalize_columns( -1 ); }
+  void normalize( const unsigned int column ) { normalize_columns( column ); }
+
+  bool is_normalized( const unsigned int column ) const { return _normalized[ column ]; }
+
+  /* copy out count pmfs from first on, each contiguous, one after another */
+  void pmfs( const unsigned int first, const unsigned int count, double *out ) const;
+  void pmf( const unsigned int column, double *out ) const { pmfs( column, 1, out ); }
+
+  /* not implemented */
+  ProcessBatch( const ProcessBatch & );
+  ProcessBatch & operator=( const ProcessBatch & );
+};
+
+#endif
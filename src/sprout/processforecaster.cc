@@ -1,6 +1,10 @@
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "processforecaster.hh"
 
@@ -22,37 +26,34 @@ std::vector< Process > ProcessForecastTick::make_components( const Process & exa
 ProcessForecastTick::ProcessForecastTick( const double tick_time,
 					  const Process & example,
 					  const unsigned int upper_limit )
-  : _count_probability()
+  : _count_probability( example.pmf().size(), upper_limit + 1 )
 {
   /* step 1: make the component processes */
   std::vector< Process > components( make_components( example ) );
 
   /* step 2: for each process component, find the distribution of arrivals */
-  for ( auto it = components.begin(); it != components.end(); it++ ) {
-    std::vector< double > this_count_probability;
+  for ( unsigned int component = 0; component < components.size(); component++ ) {
+    double *this_count_probability = _count_probability.row( component );
     double total = 0.0;
     for ( unsigned int i = 0; i < upper_limit; i++ ) {
-      const double prob = it->count_probability( tick_time, i );
+      const double prob = components[ component ].count_probability( tick_time, i );
       assert( prob >= 0 );
       assert( prob <= 1.0 );
-      this_count_probability.push_back( prob );
+      this_count_probability[ i ] = prob;
       total += prob;
     }
     assert( total < 1.0 + (1e-10) );
-    this_count_probability.push_back( 1.0 - total );
-
-    /* append to cache */
-    _count_probability.push_back( this_count_probability );
+    this_count_probability[ upper_limit ] = 1.0 - total;
   }
 }
 
 double ProcessForecastTick::probability( const Process & ensemble, unsigned int count ) const
 {
   assert( ensemble.is_normalized() );
-  assert( ensemble.pmf().size() == _count_probability.size() );
-  assert( _count_probability.size() > 0 );
+  assert( ensemble.pmf().size() == _count_probability.rows() );
+  assert( _count_probability.rows() > 0 );
 
-  assert( count < _count_probability[ 0 ].size() );
+  assert( count < _count_probability.cols() );
 
   double ret = ensemble.pmf().summation( _count_probability, count );
 
@@ -65,25 +66,49 @@ double ProcessForecastTick::probability( const Process & ensemble, unsigned int
   return ret;
 }
 
-std::vector< double > ProcessForecastInterval::convolve( const std::vector< double > & old_count_probabilities,
-							 const std::vector< double > & this_tick )
+void ProcessForecastTick::distribution( const Process & ensemble, const unsigned int limit, std::vector< double > & out ) const
+{
+  assert( ensemble.is_normalized() );
+  assert( ensemble.pmf().size() == _count_probability.rows() );
+  assert( limit <= _count_probability.cols() );
+
+  out.resize( limit );
+  _count_probability.transpose_multiply( ensemble.pmf().data(), 0, limit, out.data() );
+
+  for ( unsigned int i = 0; i < limit; i++ ) {
+    assert( out[ i ] <= 1.0 + 1e-10 );
+
+    if ( out[ i ] > 1.0 ) {
+      out[ i ] = 1.0;
+    }
+  }
+}
+
+template <class Scalar>
+std::vector< double > BasicProcessForecastInterval< Scalar >::convolve( const std::vector< double > & old_count_probabilities,
+									const std::vector< double > & this_tick )
 {
   std::vector< double > ret( old_count_probabilities.size() + this_tick.size() - 1 );
+  const double *tick = this_tick.data();
 
+  /* one contiguous multiply-add per old count */
   for ( unsigned int old_count = 0; old_count < old_count_probabilities.size(); old_count++ ) {
+    const double weight = old_count_probabilities[ old_count ];
+    double *out = ret.data() + old_count;
     for ( unsigned int new_count = 0; new_count < this_tick.size(); new_count++ ) {
-      ret[ old_count + new_count ] += old_count_probabilities[ old_count ] * this_tick[ new_count ];
+      out[ new_count ] += weight * tick[ new_count ];
     }
   }
 
   return ret;
 }
 
-ProcessForecastInterval::ProcessForecastInterval( const double tick_time,
-						  const Process & example,
-						  const unsigned int tick_upper_limit,
-						  const unsigned int num_ticks )
-  : _count_probability()
+template <class Scalar>
+BasicProcessForecastInterval< Scalar >::BasicProcessForecastInterval( const double tick_time,
+								      const Process & example,
+								      const unsigned int tick_upper_limit,
+								      const unsigned int num_ticks )
+  : _count_probability( example.pmf().size(), num_ticks * (tick_upper_limit - 1) + 1 )
 {
   /* step 1: make the component processes */
   std::vector< Process > components( ProcessForecastTick::make_components( example ) );
@@ -92,38 +117,101 @@ ProcessForecastInterval::ProcessForecastInterval( const double tick_time,
   ProcessForecastTick tick_forecast( tick_time, example, tick_upper_limit );
 
   /* step 3: for each component, integrate and evolve forward */
-  for ( auto it = components.begin(); it != components.end(); it++ ) {
+  for ( unsigned int component = 0; component < components.size(); component++ ) {
+    Process & process = components[ component ];
     std::vector< double > this_component_count_probability( 1, 1.0 );
+    std::vector< double > this_tick;
     for ( unsigned int tick = 0; tick < num_ticks; tick++ ) {
       /* collect tick forecast */
-      std::vector< double > this_tick;
-      for ( unsigned int i = 0; i < tick_upper_limit; i++ ) {
-	it->normalize();
-	this_tick.push_back( tick_forecast.probability( *it, i ) );
-      }
+      process.normalize();
+      tick_forecast.distribution( process, tick_upper_limit, this_tick );
 
       /* add to previous forecast */
       this_component_count_probability = convolve( this_component_count_probability,
 						   this_tick );
 
       /* evolve forward */
-      it->evolve( tick_time );
+      process.evolve( tick_time );
     }
 
-    _count_probability.push_back( this_component_count_probability );
+    assert( this_component_count_probability.size() == _count_probability.cols() );
+    std::copy( this_component_count_probability.begin(), this_component_count_probability.end(),
+	       _count_probability.row( component ) );
   }
 }
 
+template <class Scalar>
+std::vector< BasicProcessForecastInterval< Scalar > > BasicProcessForecastInterval< Scalar >::make_horizons( const double tick_time,
+													     const Process & example,
+													     const unsigned int tick_upper_limit,
+													     const unsigned int num_ticks,
+													     unsigned int num_threads )
+{
+  std::vector< Process > components( ProcessForecastTick::make_components( example ) );
+  const ProcessForecastTick tick_forecast( tick_time, example, tick_upper_limit );
+
+  std::vector< Matrix > tables;
+  for ( unsigned int tick = 0; tick < num_ticks; tick++ ) {
+    tables.push_back( Matrix( components.size(), (tick + 1) * (tick_upper_limit - 1) + 1 ) );
+  }
+
+  /* each worker takes the next unclaimed component; rows are
+     padded to cache lines, so writers never share a line */
+  std::atomic< unsigned int > next_component( 0 );
+  auto worker = [&] ( void ) {
+    std::vector< double > this_tick;
+    for ( unsigned int component = next_component++;
+	  component < components.size();
+	  component = next_component++ ) {
+      /* evolved in place, so the shared kernels stay cached for the others */
+      Process & process = components[ component ];
+      std::vector< double > this_component_count_probability( 1, 1.0 );
+      for ( unsigned int tick = 0; tick < num_ticks; tick++ ) {
+	process.normalize();
+	tick_forecast.distribution( process, tick_upper_limit, this_tick );
+	this_component_count_probability = convolve( this_component_count_probability, this_tick );
+
+	assert( this_component_count_probability.size() == tables[ tick ].cols() );
+	std::copy( this_component_count_probability.begin(), this_component_count_probability.end(),
+		   tables[ tick ].row( component ) );
+
+	process.evolve( tick_time );
+      }
+    }
+  };
+
+  if ( num_threads == 0 ) {
+    num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+  }
+
+  std::vector< std::thread > threads;
+  for ( unsigned int i = 1; i < num_threads; i++ ) {
+    threads.push_back( std::thread( worker ) );
+  }
+  worker();
+  for ( auto it = threads.begin(); it != threads.end(); it++ ) {
+    it->join();
+  }
+
+  std::vector< BasicProcessForecastInterval > ret;
+  for ( auto it = tables.begin(); it != tables.end(); it++ ) {
+    ret.push_back( BasicProcessForecastInterval( BasicMatrix< Scalar >( *it ) ) );
+  }
+  return ret;
+}
+
 /* exact same routine as for ProcessForecastTick! */
-double ProcessForecastInterval::probability( const Process & ensemble, unsigned int count ) const
+template <class Scalar>
+double BasicProcessForecastInterval< Scalar >::probability( const Process & ensemble, unsigned int count ) const
 {
   assert( ensemble.is_normalized() );
-  assert( ensemble.pmf().size() == _count_probability.size() );
-  assert( _count_probability.size() > 0 );
+  assert( ensemble.pmf().size() == _count_probability.rows() );
+  assert( _count_probability.rows() > 0 );
 
-  assert( count < _count_probability[ 0 ].size() );
+  assert( count < _count_probability.cols() );
 
-  double ret = ensemble.pmf().summation( _count_probability, count );
+  double ret;
+  _count_probability.transpose_multiply( ensemble.pmf().data(), count, 1, &ret );
 
   if ( ret > 1.0 ) {
     fprintf( stderr, "Error, prob = %f\n", ret );
@@ -133,42 +221,162 @@ double ProcessForecastInterval::probability( const Process & ensemble, unsigned
   return ret;
 }
 
-unsigned int ProcessForecastInterval::lower_quantile( const Process & ensemble, const double x ) const
+EnsembleSupport::EnsembleSupport( const Process & ensemble, const double threshold )
+  : EnsembleSupport( ensemble.pmf().data(), ensemble.pmf().size(), threshold )
+{}
+
+EnsembleSupport::EnsembleSupport( const double *pmf, const unsigned int size, const double threshold )
+  : bins(),
+    neglected_mass( 0.0 )
+{
+  for ( unsigned int i = 0; i < size; i++ ) {
+    if ( pmf[ i ] > threshold ) {
+      bins.push_back( i );
+    } else {
+      neglected_mass += pmf[ i ];
+    }
+  }
+}
+
+template <class Scalar>
+void BasicProcessForecastInterval< Scalar >::accumulate_counts( const double *pmf, const EnsembleSupport & support,
+								const unsigned int first, const unsigned int width,
+								double *out ) const
+{
+  _count_probability.transpose_multiply( pmf, support.bins, first, width, out );
+
+  for ( unsigned int c = 0; c < width; c++ ) {
+    if ( out[ c ] > 1.0 ) {
+      fprintf( stderr, "Error, prob = %f\n", out[ c ] );
+      out[ c ] = 1.0;
+    }
+  }
+}
+
+template <class Scalar>
+void BasicProcessForecastInterval< Scalar >::count_distribution( const Process & ensemble, std::vector< double > & out ) const
+{
+  assert( ensemble.is_normalized() );
+  assert( ensemble.pmf().size() == _count_probability.rows() );
+
+  out.resize( max_count() );
+  accumulate_counts( ensemble.pmf().data(), EnsembleSupport( ensemble, 0.0 ), 0, max_count(), out.data() );
+}
+
+template <class Scalar>
+bool BasicProcessForecastInterval< Scalar >::search_quantiles( const double *pmf, const EnsembleSupport & support,
+							       const double *x, const unsigned int n,
+							       const unsigned int hint, unsigned int *result ) const
 {
+  const bool exact = ( support.neglected_mass == 0.0 );
+  std::vector< double > block( std::max( hint + 1, COUNT_BLOCK ) );
   double sum = 0.0;
+  bool certain = true;
+  unsigned int k = 0;
+
+  /* build the CDF a block of counts at a time, stopping once it reaches
+     the last x. The first block covers every count up to the hint. */
+  unsigned int width = 0;
+  for ( unsigned int first = 0; first < max_count() && k < n; first += width ) {
+    width = std::min( first ? COUNT_BLOCK : (unsigned int)block.size(), max_count() - first );
+    accumulate_counts( pmf, support, first, width, block.data() );
 
-  for ( unsigned int i = 0; i < _count_probability[ 0 ].size(); i++ ) {
-    sum += probability( ensemble, i );
+    for ( unsigned int c = 0; c < width && k < n; c++ ) {
+      sum += block[ c ];
 
-    if ( sum >= x ) {
-      return i;
+      for ( ; k < n; k++ ) {
+	assert( k == 0 || x[ k ] >= x[ k - 1 ] );
+
+	if ( exact ) {
+	  if ( !( sum >= x[ k ] ) ) {
+	    break;
+	  }
+	} else if ( sum + support.neglected_mass + TOLERANCE >= x[ k ] ) {
+	  /* the true CDF lies between sum and sum + neglected_mass */
+	  certain = certain && ( sum >= x[ k ] + TOLERANCE );
+	} else {
+	  break;
+	}
+
+	result[ k ] = first + c;
+      }
     }
   }
 
-  return _count_probability[ 0 ].size() + 1;
+  for ( ; k < n; k++ ) {
+    result[ k ] = max_count() + 1;
+  }
+
+  return certain;
+}
+
+template <class Scalar>
+unsigned int BasicProcessForecastInterval< Scalar >::lower_quantile( const Process & ensemble, const double x ) const
+{
+  return lower_quantile( ensemble, EnsembleSupport( ensemble ), x );
+}
+
+template <class Scalar>
+unsigned int BasicProcessForecastInterval< Scalar >::lower_quantile( const Process & ensemble, const EnsembleSupport & support,
+								     const double x, const unsigned int hint ) const
+{
+  assert( ensemble.is_normalized() );
+  assert( ensemble.pmf().size() == _count_probability.rows() );
+
+  return lower_quantile( ensemble.pmf().data(), support, x, hint );
+}
+
+template <class Scalar>
+unsigned int BasicProcessForecastInterval< Scalar >::lower_quantile( const double *pmf, const EnsembleSupport & support,
+								     const double x, const unsigned int hint ) const
+{
+  unsigned int result;
+  lower_quantiles( pmf, support, &x, 1, &result, hint );
+  return result;
+}
+
+template <class Scalar>
+void BasicProcessForecastInterval< Scalar >::lower_quantiles( const double *pmf, const EnsembleSupport & support,
+							      const double *x, const unsigned int n,
+							      unsigned int *result, const unsigned int hint ) const
+{
+  if ( !search_quantiles( pmf, support, x, n, hint, result ) ) {
+    /* too close to call; sum over every bin */
+    search_quantiles( pmf, EnsembleSupport( pmf, _count_probability.rows(), 0.0 ), x, n, hint, result );
+  }
 }
 
 /* construct from saved protobuf */
-ProcessForecastInterval::ProcessForecastInterval( const Sprout::ProcessForecastInterval &storedmodel )
-  : _count_probability()
+template <class Scalar>
+BasicProcessForecastInterval< Scalar >::BasicProcessForecastInterval( const Sprout::ProcessForecastInterval &storedmodel )
+  : _count_probability( storedmodel.count_probabilities_size(),
+			storedmodel.count_probabilities_size() ? storedmodel.count_probabilities( 0 ).count_probability_size() : 0 )
 {
   for ( int i = 0; i < storedmodel.count_probabilities_size(); i++ ) {
-    std::vector< double > this_component_count_probability;
-    for ( int j = 0; j < storedmodel.count_probabilities( i ).count_probability_size(); j++ ) {
-      this_component_count_probability.push_back( storedmodel.count_probabilities( i ).count_probability( j ) );
+    const Sprout::CountProbability & stored_row = storedmodel.count_probabilities( i );
+    if ( stored_row.count_probability_size() != int( _count_probability.cols() ) ) {
+      fprintf( stderr, "Model has rows of %d and %u counts.\n",
+	       stored_row.count_probability_size(), _count_probability.cols() );
+      exit( 1 );
     }
-    _count_probability.push_back( this_component_count_probability );
+    std::copy( stored_row.count_probability().begin(), stored_row.count_probability().end(),
+	       _count_probability.row( i ) );
   }
 }
 
-Sprout::ProcessForecastInterval ProcessForecastInterval::to_protobuf( void ) const
+template <class Scalar>
+Sprout::ProcessForecastInterval BasicProcessForecastInterval< Scalar >::to_protobuf( void ) const
 {
   Sprout::ProcessForecastInterval ret;
-  for ( unsigned int i = 0; i < _count_probability.size(); i++ ) {
+  for ( unsigned int i = 0; i < _count_probability.rows(); i++ ) {
     auto *this_component = ret.add_count_probabilities();
-    for ( unsigned int j = 0; j < _count_probability.at( i ).size(); j++ ) {
-      this_component->add_count_probability( _count_probability.at( i ).at( j ) );
+    for ( unsigned int j = 0; j < _count_probability.cols(); j++ ) {
+      this_component->add_count_probability( _count_probability( i, j ) );
     }
   }
   return ret;
 }
+
+template class BasicProcessForecastInterval< double >;
+template class BasicProcessForecastInterval< float >;
+template class BasicProcessForecastInterval< Fixed16 >;
@@ -2,6 +2,7 @@
 #define PROCESSFORECASTER_HH
 
 #include "process.hh"
+#include "matrix.hh"
 #include "sproutmath.pb.h"
 
 #include <vector>
@@ -9,38 +10,120 @@
 class ProcessForecastTick
 {
 private:
-  std::vector< std::vector< double > > _count_probability;
+  Matrix _count_probability; /* component x count */
 
 public:
   ProcessForecastTick( const double tick_time, const Process & example, const unsigned int upper_limit );
 
-  double probability( unsigned int component, unsigned int count ) const { return _count_probability[ component ][ count ]; }
+  double probability( unsigned int component, unsigned int count ) const { return _count_probability( component, count ); }
   double probability( const Process & ensemble, unsigned int count ) const;
 
+  /* probability of counts [ 0, limit ) in one pass */
+  void distribution( const Process & ensemble, const unsigned int limit, std::vector< double > & out ) const;
+
   static std::vector< Process > make_components( const Process & example );
 };
 
-class ProcessForecastInterval
+/* The rate bins of an ensemble that carry non-negligible probability.
+   Forecasts sum over these bins only, and use the mass left out to
+   bound their error. One support serves every interval of a forecast. */
+class EnsembleSupport
+{
+public:
+  static constexpr double NEGLIGIBLE = 1e-9;
+
+  std::vector< unsigned int > bins;
+  double neglected_mass;
+
+  EnsembleSupport( const Process & ensemble, const double threshold = NEGLIGIBLE );
+  EnsembleSupport( const double *pmf, const unsigned int size, const double threshold = NEGLIGIBLE );
+};
+
+/* The count forecast for one interval, as a table of count
+   probabilities per component. Tables are built in double; a copy
+   can be held as float or Fixed16 to halve or quarter the memory
+   read by each forecast, at some cost in accuracy. */
+template <class Scalar>
+class BasicProcessForecastInterval
 {
 private:
-  std::vector< std::vector< double > > _count_probability;
+  BasicMatrix< Scalar > _count_probability; /* component x count */
 
   static std::vector< double > convolve( const std::vector< double > & old_count_probabilities,
 					 const std::vector< double > & this_tick );
 
+  /* counts accumulated per pass after the first */
+  static const unsigned int COUNT_BLOCK = 4;
+
+  /* margin for rounding when deciding a quantile from a partial support */
+  static constexpr double TOLERANCE = 1e-12;
+
+  /* out[ c ] = probability of count first + c over the support, for c < width */
+  void accumulate_counts( const double *pmf, const EnsembleSupport & support,
+			  const unsigned int first, const unsigned int width, double *out ) const;
+
+  /* quantiles x[ 0 ] <= x[ 1 ] <= ... in one pass over the counts;
+     false if the neglected mass leaves any answer in doubt */
+  bool search_quantiles( const double *pmf, const EnsembleSupport & support,
+			 const double *x, const unsigned int n, const unsigned int hint,
+			 unsigned int *result ) const;
+
 public:
-  ProcessForecastInterval( const double tick_time,
-			   const Process & example,
-			   const unsigned int tick_upper_limit,
-			   const unsigned int num_ticks );
+  BasicProcessForecastInterval( const double tick_time,
+				const Process & example,
+				const unsigned int tick_upper_limit,
+				const unsigned int num_ticks );
 
-  ProcessForecastInterval( const Sprout::ProcessForecastInterval &storedmodel );
+  BasicProcessForecastInterval( const Sprout::ProcessForecastInterval &storedmodel );
+
+  /* The intervals for 1 through num_ticks ticks, in one pass: the
+     forecast for n + 1 ticks extends the one for n. Components are
+     spread over num_threads threads (0 = one per core). */
+  static std::vector< BasicProcessForecastInterval > make_horizons( const double tick_time,
+								    const Process & example,
+								    const unsigned int tick_upper_limit,
+								    const unsigned int num_ticks,
+								    unsigned int num_threads = 0 );
+
+  /* wrap a precomputed table, e.g. a view into a mapped model file */
+  BasicProcessForecastInterval( const BasicMatrix< Scalar > & count_probability ) : _count_probability( count_probability ) {}
+
+  /* a copy with the table rounded to this scalar type */
+  template <class Other>
+  explicit BasicProcessForecastInterval( const BasicProcessForecastInterval< Other > & other )
+    : _count_probability( other.count_probability() ) {}
 
   Sprout::ProcessForecastInterval to_protobuf( void ) const;
 
+  const BasicMatrix< Scalar > & count_probability( void ) const { return _count_probability; }
+
   double probability( const Process & ensemble, unsigned int count ) const;
 
+  unsigned int max_count( void ) const { return _count_probability.cols(); }
+
+  /* probability of every count, in one pass over the matrix */
+  void count_distribution( const Process & ensemble, std::vector< double > & out ) const;
+
   unsigned int lower_quantile( const Process & ensemble, const double x ) const;
+
+  /* The hint is a count not expected to exceed the answer (e.g. the
+     quantile for a shorter interval); it only sets how many counts
+     are computed in the first pass. The result is the same as summing
+     over every bin. */
+  unsigned int lower_quantile( const Process & ensemble, const EnsembleSupport & support,
+			       const double x, const unsigned int hint = 0 ) const;
+
+  /* the same, for a normalized pmf held elsewhere */
+  unsigned int lower_quantile( const double *pmf, const EnsembleSupport & support,
+			       const double x, const unsigned int hint = 0 ) const;
+
+  /* n quantiles, in increasing order, for the cost of the largest;
+     the hint is as above, for the largest */
+  void lower_quantiles( const double *pmf, const EnsembleSupport & support,
+			const double *x, const unsigned int n, unsigned int *result,
+			const unsigned int hint = 0 ) const;
 };
 
+typedef BasicProcessForecastInterval< double > ProcessForecastInterval;
+
 #endif
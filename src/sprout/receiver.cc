@@ -1,148 +1,110 @@
 #include <assert.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 
 #include "receiver.hh"
-#include "sproutmath.pb.h"
-
-Receiver::Receiver()
-  : _process( MAX_ARRIVAL_RATE,
-	      BROWNIAN_MOTION_RATE,
-	      OUTAGE_ESCAPE_RATE,
-	      NUM_BINS ),
-    _forecastr(),
+
+ReceiverConfig::ReceiverConfig()
+  : model(),
+    quantile( 0.05 ),
+    extra_quantiles(),
+    precision( FORECAST_DOUBLE )
+{
+  model.max_arrival_rate = 1000;
+  model.brownian_motion_rate = 200;
+  model.outage_escape_rate = 1;
+  model.num_bins = 256;
+  model.tick_length = 20;
+  model.max_arrivals_per_tick = 30;
+  model.num_ticks = 8;
+}
+
+Receiver::Receiver( const ReceiverConfig & config )
+  : _config( config ),
+    _process( _config.model.max_arrival_rate,
+	      _config.model.brownian_motion_rate,
+	      _config.model.outage_escape_rate,
+	      _config.model.num_bins ),
+    _forecastr( ForecastModel::get( _config.model ) ),
     _time( 0 ),
     _score_time( -1 ),
     _count_this_tick( 0 ),
+    _levels( _config.quantile, _config.extra_quantiles ),
     _cached_forecast(),
+    _counts(),
     _recv_queue()
 {
-  char *filename_in = getenv( "SPROUT_MODEL_IN" );
-  if ( filename_in ) {
-    /* try to open */
-    int fd = open( filename_in, O_RDONLY );
-    if ( fd < 0 ) {
-      fprintf( stderr, "Could not open %s.\n", filename_in );
-      perror( "open" );
-      exit( 1 );
-    }
-
-    fprintf( stderr, "Reading model from %s...", filename_in );
-
-    Sprout::SproutModel model;
-    if ( !model.ParseFromFileDescriptor( fd ) ) {
-      fprintf( stderr, "Could not parse %s.\n", filename_in );
-      exit( 1 );
-    }
+}
 
-    assert( model.intervals_size() == NUM_TICKS );
+void Receiver::advance_to_us( const uint64_t time )
+{
+  assert( time >= _time );
 
-    for ( int i = 0; i < NUM_TICKS; i++ ) {
-      fprintf( stderr, "[tick %d", i );
-      ProcessForecastInterval one_forecast( model.intervals( i ) );
-      _forecastr.push_back( one_forecast );
-      fprintf( stderr, "] " );
-    }
-    fprintf( stderr, " done.\n" );
+  const uint64_t tick_length = 1000 * uint64_t( _config.model.tick_length );
+  const double tick_seconds = .001 * _config.model.tick_length;
 
-    if ( close( fd ) < 0 ) {
-      perror( "close" );
-      exit( 1 );
-    }
-  } else {
-    fprintf( stderr, "Starting statistical calculations..." );
-    for ( int i = 0; i < NUM_TICKS; i++ ) {
-      fprintf( stderr, "[tick %d", i );
-      ProcessForecastInterval one_forecast( .001 * TICK_LENGTH,
-					    _process,
-					    MAX_ARRIVALS_PER_TICK,
-					    i + 1 );
-      _forecastr.push_back( one_forecast );
-      fprintf( stderr, "] " );
+  while ( _time + tick_length < time ) {
+    if ( _count_this_tick > 0 ) {
+      _process.tick( tick_seconds, discrete_count( _count_this_tick ) );
+      _count_this_tick = 0;
+      _time += tick_length;
+      continue;
     }
-    fprintf( stderr, " done.\n" );
-  }
 
-  char *filename_out = getenv( "SPROUT_MODEL_OUT" );
-  if ( filename_out ) {
-    /* try to open */
-    int fd = open( filename_out, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR );
-    if ( fd < 0 ) {
-      fprintf( stderr, "Could not open %s.\n", filename_out );
-      perror( "open" );
-      exit( 1 );
+    /* nothing received: count the idle ticks before the next change
+       between observing (zero arrivals) and skipping */
+    const bool observe = ( _time >= _score_time );
+    uint64_t ticks = 1;
+    while ( _time + ( ticks + 1 ) * tick_length < time
+	    && ( _time + ticks * tick_length >= _score_time ) == observe ) {
+      ticks++;
     }
 
-    fprintf( stderr, "Writing model to %s...", filename_out );
-  
-    Sprout::SproutModel model;
-    for ( int i = 0; i < NUM_TICKS; i++ ) {
-      auto *x = model.add_intervals();
-      *x = _forecastr.at( i ).to_protobuf();
-    }
-    
-    if ( !model.SerializeToFileDescriptor( fd ) ) {
-      fprintf( stderr, "Could not serialize model.\n" );
-      exit( 1 );
-    }
-
-    if ( close( fd ) < 0 ) {
-      perror( "close" );
-      exit( 1 );
+    if ( ticks >= FAST_FORWARD_TICKS ) {
+      _process.fast_forward( tick_seconds, ticks, observe );
+    } else {
+      for ( uint64_t i = 0; i < ticks; i++ ) {
+	if ( observe ) {
+	  _process.tick( tick_seconds, 0 );
+	} else {
+	  _process.evolve( tick_seconds );
+	}
+      }
     }
-
-    fprintf( stderr, "done.\n" );
+    _time += ticks * tick_length;
   }
 }
 
-void Receiver::advance_to( const uint64_t time )
+int Receiver::discrete_count( const double count )
 {
-  assert( time >= _time );
-
-  while ( _time + TICK_LENGTH < time ) {
-    _process.evolve( .001 * TICK_LENGTH );
-    if ( (_time >= _score_time) || (_count_this_tick > 0) ) {
-      int discrete_observe = int( _count_this_tick + 0.5 );
-      if ( _count_this_tick > 0 && _count_this_tick < 1 ) {
-	discrete_observe = 1;
-      }
-      _process.observe( .001 * TICK_LENGTH, discrete_observe );
-      //      fprintf( stderr, "tick(%f) ", _count_this_tick );
-      _count_this_tick = 0;
-    } else {
-      //      fprintf( stderr, "-SKIP-" );
-    }
-    _time += TICK_LENGTH;
+  if ( count > 0 && count < 1 ) {
+    return 1;
   }
+  return int( count + 0.5 );
 }
 
 void Receiver::recv( const uint64_t seq, const uint16_t throwaway_window, const uint16_t time_to_next, const size_t len )
 {
   _count_this_tick += len / 1400.0;
   _recv_queue.recv( seq, throwaway_window, len );
-  _score_time = std::max( _time + time_to_next, _score_time );
+  _score_time = std::max( _time + 1000 * uint64_t( time_to_next ), _score_time );
 }
 
 Sprout::DeliveryForecast Receiver::forecast( void )
 {
-  if ( _cached_forecast.time() == _time ) {
+  /* forecasts carry the time in ms; ticks are at least 1 ms apart */
+  if ( _cached_forecast.time() == _time / 1000 ) {
     return _cached_forecast;
   } else {
-    std::vector< int > counts;
-
     _process.normalize();
 
     _cached_forecast.set_received_or_lost_count( _recv_queue.packet_count() );
-    _cached_forecast.set_time( _time );
-    _cached_forecast.clear_counts();
+    _cached_forecast.set_time( _time / 1000 );
+    _cached_forecast.set_tick_length( _config.model.tick_length );
 
-    for ( auto it = _forecastr.begin(); it != _forecastr.end(); it++ ) {
-      _cached_forecast.add_counts( it->lower_quantile( _process, 0.05 ) );
-    }
+    /* every level in one search */
+    _forecastr->lower_quantiles( _process.pmf().data(), _levels.data(), _levels.size(),
+				 _config.precision, _counts );
+    _levels.fill( _counts, _cached_forecast );
 
     return _cached_forecast;
   }
@@ -150,28 +112,24 @@ Sprout::DeliveryForecast Receiver::forecast( void )
 
 void Receiver::RecvQueue::recv( const uint64_t seq, const uint16_t throwaway_window, const int len )
 {
-  received_sequence_numbers.push( PacketLen( seq, len ) );
   throwaway_before = std::max( throwaway_before, seq - throwaway_window );
-}
 
-uint64_t Receiver::RecvQueue::packet_count( void )
-{
-  /* returns cumulative count of bytes received or lost */
-  while ( !received_sequence_numbers.empty() ) {
-    if ( received_sequence_numbers.top().seq < throwaway_before ) {
-      received_sequence_numbers.pop();
-    } else {
-      break;
-    }
+  while ( !received_sequence_numbers.empty()
+	  && received_sequence_numbers.front().seq < throwaway_before ) {
+    buffer_sum -= received_sequence_numbers.front().len;
+    received_sequence_numbers.pop_front();
   }
 
-  std::priority_queue< PacketLen, std::deque<PacketLen>, PacketLen > copy( received_sequence_numbers );
+  if ( seq < throwaway_before ) {
+    return;
+  }
 
-  int buffer_sum = 0;
-  while ( !copy.empty() ) {
-    buffer_sum += copy.top().len;
-    copy.pop();
+  /* after any packets with the same or a later seq already seen */
+  auto position = received_sequence_numbers.end();
+  while ( position != received_sequence_numbers.begin() && ( position - 1 )->seq > seq ) {
+    position--;
   }
 
-  return throwaway_before + buffer_sum;
+  received_sequence_numbers.insert( position, PacketLen( seq, len ) );
+  buffer_sum += len;
 }
@@ -2,70 +2,97 @@
 #define RECEIVER_HH
 
 #include <stdint.h>
-#include <queue>
+#include <deque>
+#include <memory>
 
 #include "process.hh"
 #include "processforecaster.hh"
+#include "forecastmodel.hh"
+#include "forecastlevels.hh"
 
 #include "deliveryforecast.pb.h"
 
-class Receiver
+/* Per-connection Receiver settings. The defaults are the ones Sprout
+   was tuned with; links with different dynamics can use their own. */
+class ReceiverConfig
 {
-private:
-  static constexpr double MAX_ARRIVAL_RATE = 1000;
-  static constexpr double BROWNIAN_MOTION_RATE = 200;
-  static constexpr double OUTAGE_ESCAPE_RATE = 1;
-  static const int NUM_BINS = 256;
-  static const int TICK_LENGTH = 20;
-  static const int MAX_ARRIVALS_PER_TICK = 30;
-  static const int NUM_TICKS = 8;
+public:
+  ModelParameters model;
+  double quantile; /* of cumulative deliveries to forecast */
+  std::vector< double > extra_quantiles; /* also forecast, for the sender to choose among */
+  ForecastPrecision precision; /* of the tables read by each forecast */
 
+  ReceiverConfig();
+};
+
+class Receiver
+{
+public:
+  /* bytes received or lost so far */
   class RecvQueue {
   private:
     class PacketLen {
     public:
       uint64_t seq;
       int len;
-      bool operator()( const PacketLen & a, const PacketLen & b ) const
-      {
-	return a.seq > b.seq;
-      }
       PacketLen( const uint64_t s_seq, const int s_len ) : seq( s_seq ), len( s_len ) {}
-      PacketLen( void ) : seq( -1 ), len( 0 ) {}
     };
 
-    std::priority_queue< PacketLen, std::deque<PacketLen>, PacketLen > received_sequence_numbers;
+    /* packets at or above throwaway_before, in order of seq, and the
+       sum of their lengths; arrivals are nearly in order, so each is
+       inserted near the back and dropped from the front */
+    std::deque< PacketLen > received_sequence_numbers;
     uint64_t throwaway_before;
+    uint64_t buffer_sum;
 
   public:
-    RecvQueue() : received_sequence_numbers(), throwaway_before( 0 ) {}
+    RecvQueue() : received_sequence_numbers(), throwaway_before( 0 ), buffer_sum( 0 ) {}
 
     void recv( const uint64_t seq, const uint16_t throwaway_window, int len );
-    uint64_t packet_count( void );
+    uint64_t packet_count( void ) const { return throwaway_before + buffer_sum; }
   };
 
+private:
+  /* idle runs at least this long are applied in one step */
+  static const uint64_t FAST_FORWARD_TICKS = 8;
+
+  ReceiverConfig _config;
+
   Process _process;
 
-  std::vector< ProcessForecastInterval > _forecastr;
+  /* shared with every Receiver using the same parameters */
+  std::shared_ptr< const ForecastModel > _forecastr;
 
-  uint64_t _time, _score_time;
+  uint64_t _time, _score_time; /* us */
 
   double _count_this_tick;
 
+  ForecastLevels _levels;
+
   Sprout::DeliveryForecast _cached_forecast;
+  std::vector< unsigned int > _counts;
 
   RecvQueue _recv_queue;
 
 public:
 
-  Receiver();
-  void warp_to( const uint64_t time ) { _score_time = _time = time; }
-  void advance_to( const uint64_t time );
+  Receiver( const ReceiverConfig & config = ReceiverConfig() );
+  /* times in ms, or in us for the _us forms; ticks fall every
+     tick_length ms from the time warped to */
+  void warp_to( const uint64_t time ) { warp_to_us( 1000 * time ); }
+  void warp_to_us( const uint64_t time ) { _score_time = _time = time; }
+  void advance_to( const uint64_t time ) { advance_to_us( 1000 * time ); }
+  void advance_to_us( const uint64_t time );
   void recv( const uint64_t seq, const uint16_t throwaway_window, const uint16_t time_to_next, const size_t len );
 
   Sprout::DeliveryForecast forecast( void );
 
-  int get_tick_length( void ) const { return TICK_LENGTH; }
+  /* packets to observe for a tick's worth of bytes (in 1400-byte packets) */
+  static int discrete_count( const double count );
+
+  int get_tick_length( void ) const { return _config.model.tick_length; }
+
+  const ReceiverConfig & get_config( void ) const { return _config; }
 };
 
 #endif
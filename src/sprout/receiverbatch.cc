@@ -0,0 +1,121 @@
+#include <assert.h>
+#include <algorithm>
+
+#include "receiverbatch.hh"
+
+ReceiverBatch::Member::Member( const uint64_t time )
+  : score_time( time ),
+    count_this_tick( 0 ),
+    recv_queue(),
+    cached_forecast()
+{
+}
+
+ReceiverBatch::ReceiverBatch( const uint64_t time, const ReceiverConfig & config )
+  : _config( config ),
+    _levels( _config.quantile, _config.extra_quantiles ),
+    _processes( _config.model.max_arrival_rate,
+		_config.model.brownian_motion_rate,
+		_config.model.outage_escape_rate,
+		_config.model.num_bins ),
+    _forecastr( ForecastModel::get( _config.model ) ),
+    _time( time ),
+    _members(),
+    _counts(),
+    _quantiles(),
+    _pmf( FORECAST_BLOCK * _processes.bins() )
+{
+}
+
+unsigned int ReceiverBatch::add( void )
+{
+  const unsigned int index = _processes.add();
+  assert( index == _members.size() );
+  _members.push_back( Member( _time ) );
+  return index;
+}
+
+void ReceiverBatch::remove( const unsigned int index )
+{
+  assert( index < _members.size() );
+
+  _processes.remove( index );
+  _members[ index ] = _members.back();
+  _members.pop_back();
+}
+
+void ReceiverBatch::advance_to( const uint64_t time )
+{
+  assert( time >= _time );
+
+  const int tick_length = _config.model.tick_length;
+
+  while ( _time + tick_length < time ) {
+    /* as Receiver::advance_to, with -1 for evolve only */
+    _counts.resize( _members.size() );
+    for ( unsigned int i = 0; i < _members.size(); i++ ) {
+      Member & member = _members[ i ];
+      if ( member.count_this_tick > 0 ) {
+	_counts[ i ] = Receiver::discrete_count( member.count_this_tick );
+	member.count_this_tick = 0;
+      } else {
+	_counts[ i ] = ( _time >= member.score_time ) ? 0 : -1;
+      }
+    }
+
+    _processes.tick( .001 * tick_length, _counts );
+    _time += tick_length;
+  }
+}
+
+void ReceiverBatch::recv( const unsigned int index, const uint64_t seq, const uint16_t throwaway_window,
+			  const uint16_t time_to_next, const size_t len )
+{
+  Member & member = _members[ index ];
+
+  member.count_this_tick += len / 1400.0;
+  member.recv_queue.recv( seq, throwaway_window, len );
+  member.score_time = std::max( _time + time_to_next, member.score_time );
+}
+
+void ReceiverBatch::forecast_column( const unsigned int index, const double *pmf )
+{
+  Member & member = _members[ index ];
+
+  member.cached_forecast.set_received_or_lost_count( member.recv_queue.packet_count() );
+  member.cached_forecast.set_time( _time );
+  member.cached_forecast.set_tick_length( _config.model.tick_length );
+
+  _forecastr->lower_quantiles( pmf, _levels.data(), _levels.size(), _config.precision, _quantiles );
+  _levels.fill( _quantiles, member.cached_forecast );
+}
+
+Sprout::DeliveryForecast ReceiverBatch::forecast( const unsigned int index )
+{
+  if ( _members[ index ].cached_forecast.time() != _time ) {
+    _processes.normalize( index );
+    _processes.pmf( index, _pmf.data() );
+    forecast_column( index, _pmf.data() );
+  }
+
+  return _members[ index ].cached_forecast;
+}
+
+void ReceiverBatch::forecast_all( std::vector< Sprout::DeliveryForecast > & out )
+{
+  _processes.normalize();
+
+  out.resize( _members.size() );
+  for ( unsigned int first = 0; first < _members.size(); first += FORECAST_BLOCK ) {
+    const unsigned int count = std::min( FORECAST_BLOCK, (unsigned int)_members.size() - first );
+    _processes.pmfs( first, count, _pmf.data() );
+
+    for ( unsigned int c = 0; c < count; c++ ) {
+      const unsigned int i = first + c;
+      if ( _members[ i ].cached_forecast.time() != _time ) {
+	forecast_column( i, _pmf.data() + c * _processes.bins() );
+      }
+      out[ i ] = _members[ i ].cached_forecast;
+    }
+  }
+}
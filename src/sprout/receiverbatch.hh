@@ -0,0 +1,79 @@
+#ifndef RECEIVERBATCH_HH
+#define RECEIVERBATCH_HH
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+#include "receiver.hh"
+#include "processbatch.hh"
+
+/* Many Receivers with the same configuration and one clock (e.g. every
+   connection on a relay host), advanced and forecast together. Each
+   behaves as a Receiver warped to the batch's time when it was added,
+   except that its ticks fall on the batch's tick boundaries and idle
+   stretches are always stepped a tick at a time. */
+
+class ReceiverBatch
+{
+private:
+  class Member {
+  public:
+    uint64_t score_time;
+    double count_this_tick;
+    Receiver::RecvQueue recv_queue;
+    Sprout::DeliveryForecast cached_forecast;
+
+    Member( const uint64_t time );
+  };
+
+  ReceiverConfig _config;
+  ForecastLevels _levels;
+
+  ProcessBatch _processes;
+
+  /* shared with every Receiver using the same parameters */
+  std::shared_ptr< const ForecastModel > _forecastr;
+
+  uint64_t _time;
+
+  std::vector< Member > _members; /* by column of _processes */
+
+  std::vector< int > _counts; /* this tick's observations */
+  std::vector< unsigned int > _quantiles; /* one forecast's counts */
+  std::vector< double > _pmf;
+
+  /* from the pmf, which must already be normalized */
+  void forecast_column( const unsigned int index, const double *pmf );
+
+  /* pmfs copied out at once by forecast_all(), a cache line's worth */
+  static const unsigned int FORECAST_BLOCK = 8;
+
+public:
+  ReceiverBatch( const uint64_t time, const ReceiverConfig & config = ReceiverConfig() );
+
+  unsigned int size( void ) const { return _members.size(); }
+
+  /* returns the new Receiver's index */
+  unsigned int add( void );
+
+  /* the last Receiver takes over the removed one's index */
+  void remove( const unsigned int index );
+
+  void advance_to( const uint64_t time );
+  void recv( const unsigned int index, const uint64_t seq, const uint16_t throwaway_window,
+	     const uint16_t time_to_next, const size_t len );
+
+  Sprout::DeliveryForecast forecast( const unsigned int index );
+
+  /* every forecast, normalizing all the pmfs in one pass */
+  void forecast_all( std::vector< Sprout::DeliveryForecast > & out );
+
+  int get_tick_length( void ) const { return _config.model.tick_length; }
+
+  /* not implemented */
+  ReceiverBatch( const ReceiverBatch & );
+  ReceiverBatch & operator=( const ReceiverBatch & );
+};
+
+#endif
@@ -1,45 +1,50 @@
 #include "sampledfunction.hh"
+#include "binloops.hh"
 
 #include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 
 SampledFunction::SampledFunction( const int num_samples,
 					   const double maximum_value,
 					   const double minimum_value )
   : _offset( minimum_value ),
     _bin_width( (maximum_value - minimum_value) / num_samples ),
-    _function( int((maximum_value - minimum_value) / _bin_width) + 1, 1.0 )
+    _function( int((maximum_value - minimum_value) / _bin_width) + 1, 1.0 ),
+    _cdf(),
+    _cdf_valid( false )
 {
 }
 
-void SampledFunction::for_each( const std::function< void( const double midpoint,
-							 double & value,
-							 const unsigned int index ) > f )
+SampledFunction::SampledFunction( const SampledFunction & other )
+  : _offset( other._offset ),
+    _bin_width( other._bin_width ),
+    _function( other._function ),
+    _cdf(),
+    _cdf_valid( false )
 {
-  for ( unsigned int i = 0; i < _function.size(); i++ ) {
-    f( from_bin_mid( i ), _function[ i ], i );
-  }
 }
 
-void SampledFunction::for_each( const std::function< void( const double midpoint,
-							   const double & value,
-							   const unsigned int index ) > f ) const
+double SampledFunction::sum( void ) const
 {
-  for ( unsigned int i = 0; i < _function.size(); i++ ) {
-    f( from_bin_mid( i ), _function[ i ], i );
-  }
+  return BinLoops::dispatch( _function.size(), BinLoops::Sum( _function.data() ) );
 }
 
-void SampledFunction::for_range( const double min,
-					  const double max,
-					  const std::function< void( const double midpoint,
-								     double & value,
-								     const unsigned int index ) > f )
+void SampledFunction::scale( const double factor )
 {
-  const unsigned int limit_high = to_bin( sample_ceil( max ) );
-  for ( unsigned int i = to_bin( sample_floor( min ) ); i <= limit_high; i++ ) {
-    f( from_bin_mid( i ), _function[ i ], i );
-  }
+  _cdf_valid = false;
+  BinLoops::dispatch( _function.size(), BinLoops::Scale( _function.data(), factor ) );
+}
+
+double SampledFunction::dot( const double *other ) const
+{
+  return BinLoops::dispatch( _function.size(), BinLoops::Dot( _function.data(), other ) );
+}
+
+void SampledFunction::axpy( const double a, const double *x )
+{
+  _cdf_valid = false;
+  BinLoops::dispatch( _function.size(), BinLoops::Axpy( a, x, _function.data() ) );
 }
 
 const SampledFunction & SampledFunction::operator=( const SampledFunction & other )
@@ -47,30 +52,65 @@ const SampledFunction & SampledFunction::operator=( const SampledFunction & othe
   assert( _offset == other._offset );
   assert( _bin_width == other._bin_width );
   _function = other._function;
+  _cdf_valid = false;
 
   return *this;
 }
 
-double SampledFunction::lower_quantile( const double x ) const
+void SampledFunction::swap( SampledFunction & other )
 {
-  double sum = 0.0;
+  assert( _offset == other._offset );
+  assert( _bin_width == other._bin_width );
+  _function.swap( other._function );
+  _cdf.swap( other._cdf );
+  std::swap( _cdf_valid, other._cdf_valid );
+}
 
-  for ( unsigned int i = 0; i < _function.size(); i++ ) {
-    sum += _function[ i ];
-    //    fprintf( stderr, "%d sum=%f\n", i, sum );
-    if ( sum >= x ) {
-      if ( i == 0 ) { return 0; } else { return from_bin_floor( i ); }
+const std::vector< double > & SampledFunction::cdf( void ) const
+{
+  if ( !_cdf_valid ) {
+    /* summed in order, so each entry is the running sum a scan would see */
+    _cdf.resize( _function.size() );
+    double sum = 0.0;
+    for ( unsigned int i = 0; i < _function.size(); i++ ) {
+      sum += _function[ i ];
+      _cdf[ i ] = sum;
     }
+    _cdf_valid = true;
   }
-  return from_bin_floor( _function.size() - 1 );
+
+  return _cdf;
 }
 
-double SampledFunction::summation( const std::vector< std::vector< double > > & count_probability,
-				   const int count ) const
+double SampledFunction::lower_quantile( const double x ) const
 {
-  double ret = 0.0;
-  for ( unsigned int i = 0; i < _function.size(); i++ ) {
-    ret += _function[ i ] * count_probability[ i ][ count ];
+  const std::vector< double > & sums = cdf();
+
+  /* the sums never decrease, since no bin is negative */
+  const unsigned int i = std::lower_bound( sums.begin(), sums.end(), x ) - sums.begin();
+
+  if ( i == 0 ) {
+    return 0;
+  } else if ( i >= sums.size() ) {
+    return from_bin_floor( _function.size() - 1 );
+  } else {
+    return from_bin_floor( i );
   }
+}
+
+void SampledFunction::lower_quantiles( const std::vector< double > & x, std::vector< double > & out ) const
+{
+  out.resize( x.size() );
+  for ( unsigned int i = 0; i < x.size(); i++ ) {
+    out[ i ] = lower_quantile( x[ i ] );
+  }
+}
+
+double SampledFunction::summation( const Matrix & count_probability, const int count ) const
+{
+  assert( count_probability.rows() == _function.size() );
+
+  double ret;
+  count_probability.transpose_multiply( _function.data(), count, 1, &ret );
   return ret;
 }
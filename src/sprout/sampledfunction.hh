@@ -2,9 +2,10 @@
 #define SAMPLEDFUNCTION_HH
 
 #include <vector>
-#include <functional>
 #include <limits.h>
 
+#include "matrix.hh"
+
 static double BIG = 1.e6;
 
 class SampledFunction {
@@ -13,6 +14,14 @@ private:
   const double _bin_width;
   std::vector< double > _function;
 
+  /* running sum of _function, built on demand for quantile searches
+     (so even const use is not thread-safe); any non-const access to
+     the bins invalidates it */
+  mutable std::vector< double > _cdf;
+  mutable bool _cdf_valid;
+
+  const std::vector< double > & cdf( void ) const;
+
   unsigned int to_bin( double x ) const { int ret = (x - _offset) / _bin_width; if ( ret < 0 ) { return 0; } else if ( ret >= (int)_function.size() ) { return _function.size() - 1; } else { return ret; } }
 
   double from_bin_floor( unsigned int bin ) const { if ( bin <= 0 ) { return -BIG; } else { return bin * _bin_width + _offset; } }
@@ -21,32 +30,71 @@ private:
 
 public:
   SampledFunction( const int num_samples, const double maximum_value, const double minimum_value );
+  SampledFunction( const SampledFunction & other );
 
   unsigned int size( void ) const { return _function.size(); }
+  double offset( void ) const { return _offset; }
+  double bin_width( void ) const { return _bin_width; }
   unsigned int index( const double x ) const { return to_bin( x ); }
-  double & operator[]( const double x ) { return _function[ to_bin( x ) ]; }
+  double & operator[]( const double x ) { _cdf_valid = false; return _function[ to_bin( x ) ]; }
   const double & operator[]( const double x ) const { return _function[ to_bin( x ) ]; }
 
+  /* contiguous storage, one element per bin */
+  double * data( void ) { _cdf_valid = false; return _function.data(); }
+  const double * data( void ) const { return _function.data(); }
+
   double sample_floor( double x ) const { return from_bin_floor( to_bin( x ) ); }
   double sample_ceil( double x ) const { return from_bin_ceil( to_bin( x ) ); }
 
-  void for_each( const std::function< void( const double midpoint,
-					    double & value,
-					    const unsigned int index ) > f );
-  void for_each( const std::function< void( const double midpoint,
-					    const double & value,
-					    const unsigned int index ) > f ) const;
-  void for_range( const double min, const double max,
-		  const std::function< void( const double midpoint,
-					     double & value,
-					     const unsigned int index ) > f );
+  /* visit each bin as f( midpoint, value, index ); the visitor is a
+     template argument, so it inlines into a plain loop */
+  template <class Visitor>
+  void for_each( Visitor f )
+  {
+    _cdf_valid = false;
+    for ( unsigned int i = 0; i < _function.size(); i++ ) {
+      f( from_bin_mid( i ), _function[ i ], i );
+    }
+  }
+
+  template <class Visitor>
+  void for_each( Visitor f ) const
+  {
+    for ( unsigned int i = 0; i < _function.size(); i++ ) {
+      f( from_bin_mid( i ), _function[ i ], i );
+    }
+  }
+
+  /* visit the bins covering [min, max] */
+  template <class Visitor>
+  void for_range( const double min, const double max, Visitor f )
+  {
+    _cdf_valid = false;
+    const unsigned int limit_high = to_bin( sample_ceil( max ) );
+    for ( unsigned int i = to_bin( sample_floor( min ) ); i <= limit_high; i++ ) {
+      f( from_bin_mid( i ), _function[ i ], i );
+    }
+  }
+
+  /* bulk operations over every bin; other arrays have size() elements */
+  double sum( void ) const;
+  void scale( const double factor );
+  double dot( const double *other ) const;
+  void axpy( const double a, const double *x );
 
   const SampledFunction & operator=( const SampledFunction & other );
 
+  /* exchange values with a function over the same bins */
+  void swap( SampledFunction & other );
+
+  /* the floor of the first bin where the running sum reaches x, by
+     binary search over the cached sums */
   double lower_quantile( const double x ) const;
 
-  double summation( const std::vector< std::vector< double > > & count_probability,
-		    const int count ) const;
+  /* several quantiles from one build of the sums */
+  void lower_quantiles( const std::vector< double > & x, std::vector< double > & out ) const;
+
+  double summation( const Matrix & count_probability, const int count ) const;
 };
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef SHAREDCACHE_HH
+#define SHAREDCACHE_HH
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+/* Process-wide registry of immutable objects. Every caller asking
+   for the same key gets the same object, which is freed when the
+   last user lets go of it. */
+
+template <class Key, class Value>
+class SharedCache
+{
+private:
+  std::mutex _mutex;
+  std::map< Key, std::weak_ptr< const Value > > _entries;
+
+  void prune( void )
+  {
+    for ( auto it = _entries.begin(); it != _entries.end(); ) {
+      if ( it->second.expired() ) {
+	it = _entries.erase( it );
+      } else {
+	it++;
+      }
+    }
+  }
+
+public:
+  SharedCache() : _mutex(), _entries() {}
+
+  /* make() returns a new Value, and is only called on a miss */
+  template <class Factory>
+  std::shared_ptr< const Value > get( const Key & key, Factory make )
+  {
+    std::lock_guard< std::mutex > lock( _mutex );
+
+    std::shared_ptr< const Value > ret( _entries[ key ].lock() );
+    if ( !ret ) {
+      prune();
+      ret.reset( make() );
+      _entries[ key ] = ret;
+    }
+
+    return ret;
+  }
+
+  /* not implemented */
+  SharedCache( const SharedCache & );
+  SharedCache & operator=( const SharedCache & );
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <math.h>
+#include <tuple>
+#include <algorithm>
+
+#include "transitionkernel.hh"
+#include "sharedcache.hh"
+
+TransitionKernel::TransitionKernel( const SampledFunction & geometry,
+				    const double s_stddev,
+				    const double s_zero_escape_probability,
+				    const std::function< double( const double ) > & cdf )
+  : _stddev( s_stddev ),
+    _zero_escape_probability( s_zero_escape_probability ),
+    _first( geometry.size(), 0 ),
+    _length( geometry.size(), 0 ),
+    _start( geometry.size(), 0 ),
+    _weights()
+{
+  /* same traversal as the original per-pair evolve, collected by new bin */
+  std::vector< std::vector< double > > rows( geometry.size() );
+  SampledFunction scratch( geometry );
+
+  geometry.for_each( [&]
+		     ( const double old_rate, const double &, const unsigned int old_index )
+		     {
+		       scratch.for_range( old_rate - 5 * _stddev,
+					  old_rate + 5 * _stddev,
+					  [&]
+					  ( const double new_rate, double &, const unsigned int new_index )
+					  {
+					    double zfactor = 1.0;
+
+					    if ( old_index == 0 ) {
+					      zfactor = ( new_index != 0 ) ? _zero_escape_probability : (1 - _zero_escape_probability);
+					    }
+
+					    const double weight = zfactor
+					      * ( cdf( scratch.sample_ceil( new_rate ) - old_rate )
+						  - cdf( scratch.sample_floor( new_rate ) - old_rate ) );
+
+					    assert( !isnan( weight ) );
+					    assert( weight >= 0.0 );
+					    assert( weight <= 1.0 );
+
+					    /* the old bins feeding each new bin are contiguous */
+					    if ( rows[ new_index ].empty() ) {
+					      _first[ new_index ] = old_index;
+					    }
+					    assert( _first[ new_index ] + rows[ new_index ].size() == old_index );
+
+					    rows[ new_index ].push_back( weight );
+					  } );
+		     } );
+
+  for ( unsigned int j = 0; j < rows.size(); j++ ) {
+    _start[ j ] = _weights.size();
+    _length[ j ] = rows[ j ].size();
+    _weights.insert( _weights.end(), rows[ j ].begin(), rows[ j ].end() );
+  }
+}
+
+/* four independent accumulators let the compiler keep several
+   multiply-adds in flight and pack them into vector registers */
+static double dot( const double * __restrict__ a, const double * __restrict__ b, const unsigned int n )
+{
+  double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  unsigned int i = 0;
+
+  for ( ; i + 4 <= n; i += 4 ) {
+    s0 += a[ i ] * b[ i ];
+    s1 += a[ i + 1 ] * b[ i + 1 ];
+    s2 += a[ i + 2 ] * b[ i + 2 ];
+    s3 += a[ i + 3 ] * b[ i + 3 ];
+  }
+
+  for ( ; i < n; i++ ) {
+    s0 += a[ i ] * b[ i ];
+  }
+
+  return (s0 + s1) + (s2 + s3);
+}
+
+double TransitionKernel::apply( const double *old_pmf, double *new_pmf ) const
+{
+  assert( old_pmf != new_pmf );
+
+  const double *weights = _weights.data();
+  double sum = 0.0;
+
+  for ( unsigned int j = 0; j < _first.size(); j++ ) {
+    new_pmf[ j ] = dot( weights + _start[ j ], old_pmf + _first[ j ], _length[ j ] );
+    sum += new_pmf[ j ];
+  }
+
+  return sum;
+}
+
+double TransitionKernel::apply( const double *old_pmf, const double *likelihood, double *new_pmf ) const
+{
+  assert( old_pmf != new_pmf );
+
+  const double *weights = _weights.data();
+  double sum = 0.0;
+
+  for ( unsigned int j = 0; j < _first.size(); j++ ) {
+    new_pmf[ j ] = dot( weights + _start[ j ], old_pmf + _first[ j ], _length[ j ] ) * likelihood[ j ];
+    sum += new_pmf[ j ];
+  }
+
+  return sum;
+}
+
+/* columns formed together, with dot()'s four partial sums for each held in registers */
+static const unsigned int LANES = 4;
+
+static void accumulate( const double weight, const double *old_row, double *partial )
+{
+  for ( unsigned int c = 0; c < LANES; c++ ) {
+    partial[ c ] += weight * old_row[ c ];
+  }
+}
+
+/* Columns go a block at a time, so a block's rows stay in cache
+   while every new bin is formed from them. */
+void TransitionKernel::apply( const Matrix & old_pmfs, const unsigned int columns, Matrix & new_pmfs ) const
+{
+  assert( old_pmfs.rows() == size() );
+  assert( new_pmfs.rows() == size() );
+
+  const unsigned int blocks = ( columns + BATCH_COLUMNS - 1 ) / BATCH_COLUMNS;
+  assert( blocks * BATCH_COLUMNS <= old_pmfs.cols() && blocks * BATCH_COLUMNS <= new_pmfs.cols() );
+
+  const unsigned int stride = old_pmfs.stride();
+
+  for ( unsigned int block = 0; block < blocks; block++ ) {
+    for ( unsigned int j = 0; j < size(); j++ ) {
+      const double *weights = _weights.data() + _start[ j ];
+      const unsigned int first = _first[ j ];
+      const unsigned int n = _length[ j ];
+
+      for ( unsigned int offset = block * BATCH_COLUMNS; offset < ( block + 1 ) * BATCH_COLUMNS; offset += LANES ) {
+	double s0[ LANES ] = { 0 }, s1[ LANES ] = { 0 }, s2[ LANES ] = { 0 }, s3[ LANES ] = { 0 };
+	const double *old_row = old_pmfs.row( first ) + offset;
+
+	unsigned int i = 0;
+	for ( ; i + 4 <= n; i += 4, old_row += 4 * stride ) {
+	  accumulate( weights[ i ], old_row, s0 );
+	  accumulate( weights[ i + 1 ], old_row + stride, s1 );
+	  accumulate( weights[ i + 2 ], old_row + 2 * stride, s2 );
+	  accumulate( weights[ i + 3 ], old_row + 3 * stride, s3 );
+	}
+
+	for ( ; i < n; i++, old_row += stride ) {
+	  accumulate( weights[ i ], old_row, s0 );
+	}
+
+	double *out = new_pmfs.row( j ) + offset;
+	for ( unsigned int c = 0; c < LANES; c++ ) {
+	  out[ c ] = (s0[ c ] + s1[ c ]) + (s2[ c ] + s3[ c ]);
+	}
+      }
+    }
+  }
+}
+
+Matrix TransitionKernel::dense( void ) const
+{
+  Matrix ret( size(), size() );
+
+  for ( unsigned int j = 0; j < size(); j++ ) {
+    std::copy( _weights.begin() + _start[ j ], _weights.begin() + _start[ j ] + _length[ j ],
+	       ret.row( j ) + _first[ j ] );
+  }
+
+  return ret;
+}
+
+typedef std::tuple< unsigned int, double, double, double, double > KernelKey;
+
+static SharedCache< KernelKey, TransitionKernel > & kernel_cache( void )
+{
+  static SharedCache< KernelKey, TransitionKernel > cache;
+  return cache;
+}
+
+std::shared_ptr< const TransitionKernel > TransitionKernel::get( const SampledFunction & geometry,
+								 const double stddev,
+								 const double zero_escape_probability,
+								 const std::function< double( const double ) > & cdf )
+{
+  const KernelKey key( geometry.size(), geometry.offset(), geometry.bin_width(),
+		       stddev, zero_escape_probability );
+
+  return kernel_cache().get( key, [&] () {
+      return new TransitionKernel( geometry, stddev, zero_escape_probability, cdf );
+    } );
+}
@@ -0,0 +1,66 @@
+#ifndef TRANSITIONKERNEL_HH
+#define TRANSITIONKERNEL_HH
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "sampledfunction.hh"
+
+/* Banded matrix of one step of Brownian motion (plus outage escape)
+   between the bins of a SampledFunction, so that Process::evolve is a
+   matrix-vector product. Rows are stored contiguously by new bin. */
+
+class TransitionKernel
+{
+private:
+  const double _stddev;
+  const double _zero_escape_probability;
+
+  /* new bin j draws from old bins [ _first[ j ], _first[ j ] + _length[ j ] ) */
+  std::vector< unsigned int > _first;
+  std::vector< unsigned int > _length;
+  std::vector< unsigned int > _start; /* offset of row j in _weights */
+  std::vector< double > _weights;
+
+public:
+  static const unsigned int BATCH_COLUMNS = 32;
+
+  TransitionKernel( const SampledFunction & geometry,
+		    const double s_stddev,
+		    const double s_zero_escape_probability,
+		    const std::function< double( const double ) > & cdf );
+
+  unsigned int size( void ) const { return _first.size(); }
+  double stddev( void ) const { return _stddev; }
+  double zero_escape_probability( void ) const { return _zero_escape_probability; }
+
+  bool matches( const double stddev, const double zero_escape_probability ) const
+  {
+    return ( stddev == _stddev ) && ( zero_escape_probability == _zero_escape_probability );
+  }
+
+  /* new_pmf = kernel * old_pmf; returns the sum of new_pmf */
+  double apply( const double *old_pmf, double *new_pmf ) const;
+
+  /* the same, then multiplied by likelihood, in one pass */
+  double apply( const double *old_pmf, const double *likelihood, double *new_pmf ) const;
+
+  /* The same for many pmfs at once, one per column of a bin x pmf
+     matrix, as a product of the kernel and the matrix. Each column
+     gets exactly the arithmetic of the single-pmf apply(). Columns
+     go in blocks of BATCH_COLUMNS, so both matrices need room for
+     whole blocks. */
+  void apply( const Matrix & old_pmfs, const unsigned int columns, Matrix & new_pmfs ) const;
+
+  /* the kernel as a dense matrix, new bin x old bin */
+  Matrix dense( void ) const;
+
+  /* shared by every Process with the same bins and parameters */
+  static std::shared_ptr< const TransitionKernel > get( const SampledFunction & geometry,
+							const double stddev,
+							const double zero_escape_probability,
+							const std::function< double( const double ) > & cdf );
+};
+
+#endif
@@ -112,7 +112,14 @@ public:
     fatal_assert( 0 == sigaction( signum, &sa, NULL ) );
   }
 
+  /* timeout in milliseconds; negative means wait forever */
   int select( int timeout )
+  {
+    return select_us( timeout < 0 ? -1 : int64_t( timeout ) * 1000 );
+  }
+
+  /* timeout in microseconds; negative means wait forever */
+  int select_us( int64_t timeout )
   {
     memcpy( &read_fds,  &all_fds, sizeof( read_fds  ) );
     memcpy( &error_fds, &all_fds, sizeof( error_fds ) );
@@ -123,9 +130,8 @@ public:
     struct timespec *tsp = NULL;
 
     if ( timeout >= 0 ) {
-      // timeout in milliseconds
-      ts.tv_sec  = timeout / 1000;
-      ts.tv_nsec = 1000000 * (long( timeout ) % 1000);
+      ts.tv_sec  = timeout / 1000000;
+      ts.tv_nsec = 1000 * long( timeout % 1000000 );
       tsp = &ts;
     }
     // negative timeout means wait forever
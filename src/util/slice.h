@@ -0,0 +1,73 @@
+/*
+    Mosh: the mobile shell
+    Copyright 2012 Keith Winstein
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    In addition, as a special exception, the copyright holders give
+    permission to link the code of portions of this program with the
+    OpenSSL library under certain conditions as described in each
+    individual source file, and distribute linked combinations including
+    the two.
+
+    You must obey the GNU General Public License in all respects for all
+    of the code used other than OpenSSL. If you modify file(s) with this
+    exception, you may extend this exception to your version of the
+    file(s), but you are not obligated to do so. If you do not wish to do
+    so, delete this exception statement from your version. If you delete
+    this exception statement from all source files in the program, then
+    also delete it here.
+*/
+
+#ifndef SLICE_HPP
+#define SLICE_HPP
+
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+/* A view of bytes owned elsewhere (usually a receive buffer), valid
+   only as long as they are. Copies happen only in tostring(). */
+
+class Slice {
+private:
+  const char *_data;
+  size_t _size;
+
+public:
+  Slice() : _data( NULL ), _size( 0 ) {}
+  Slice( const char *s_data, size_t s_size ) : _data( s_data ), _size( s_size ) {}
+  Slice( const std::string & s ) : _data( s.data() ), _size( s.size() ) {}
+
+  const char *data( void ) const { return _data; }
+  size_t size( void ) const { return _size; }
+  bool empty( void ) const { return _size == 0; }
+
+  /* like std::string::substr(), but pos must be within the slice */
+  Slice substr( size_t pos, size_t len = std::string::npos ) const
+  {
+    assert( pos <= _size );
+    return Slice( _data + pos, std::min( len, _size - pos ) );
+  }
+
+  std::string tostring( void ) const { return std::string( _data, _size ); }
+
+  bool operator==( const Slice & x ) const
+  {
+    return ( _size == x._size ) && ( _size == 0 || 0 == memcmp( _data, x._data, _size ) );
+  }
+};
+
+#endif
@@ -44,20 +44,84 @@
  #include <sys/time.h>
 #endif
 
-static uint64_t millis_cache = -1;
+#if defined(__x86_64__) || defined(__i386__)
+ #include <x86intrin.h>
+ #include <cpuid.h>
+ #define HAVE_TSC 1
+#endif
+
+static uint64_t micros_cache = -1;
 static uint64_t millis_offset = -1;
 
-uint64_t frozen_timestamp( void )
+static bool track_staleness = false;
+static uint64_t staleness_limit = 0;
+static TimestampStaleness staleness;
+
+static uint64_t read_clock_us( void );
+
+uint64_t frozen_timestamp_us( void )
 {
-  if ( millis_cache == uint64_t( -1 ) ) {
+  if ( micros_cache == uint64_t( -1 ) ) {
     freeze_timestamp();
-    millis_offset = millis_cache - 1000;
+    millis_offset = micros_cache / 1000 - 1000;
+  } else if ( track_staleness || staleness_limit ) {
+    const uint64_t now = read_clock_us();
+    uint64_t age = ( now > micros_cache ) ? now - micros_cache : 0;
+
+    if ( staleness_limit && age > staleness_limit ) {
+      micros_cache = now;
+      age = 0;
+      staleness.refreezes++;
+    }
+
+    staleness.uses++;
+    staleness.total_us += age;
+    if ( age > staleness.max_us ) {
+      staleness.max_us = age;
+    }
   }
 
-  return millis_cache - millis_offset;
+  /* whole milliseconds are taken off, so the ms clock is this one divided */
+  return micros_cache - millis_offset * 1000;
+}
+
+uint64_t frozen_timestamp( void )
+{
+  return frozen_timestamp_us() / 1000;
 }
 
 void freeze_timestamp( void )
+{
+  const uint64_t now = read_clock_us();
+
+  /* the TSC and the clock it is anchored to may disagree slightly */
+  if ( micros_cache == uint64_t( -1 ) || now > micros_cache ) {
+    micros_cache = now;
+  }
+}
+
+void timestamp_track_staleness( const bool track )
+{
+  track_staleness = track;
+}
+
+void timestamp_limit_staleness( const uint64_t max_us )
+{
+  staleness_limit = max_us;
+}
+
+const TimestampStaleness & timestamp_staleness( void )
+{
+  return staleness;
+}
+
+void timestamp_reset_staleness( void )
+{
+  staleness = TimestampStaleness();
+}
+
+/* the system's monotonic clock, or the cached time if it fails */
+static uint64_t system_clock_us( void )
 {
 #if HAVE_CLOCK_GETTIME
   struct timespec tp;
@@ -65,11 +129,10 @@ void freeze_timestamp( void )
   if ( clock_gettime( CLOCK_MONOTONIC, &tp ) < 0 ) {
     /* did not succeed */
   } else {
-    uint64_t millis = tp.tv_nsec / 1000000;
-    millis += uint64_t( tp.tv_sec ) * 1000;
+    uint64_t micros = tp.tv_nsec / 1000;
+    micros += uint64_t( tp.tv_sec ) * 1000000;
 
-    millis_cache = millis;
-    return;
+    return micros;
   }
 #elif HAVE_MACH_ABSOLUTE_TIME
   static mach_timebase_info_data_t s_timebase_info;
@@ -79,22 +142,94 @@ void freeze_timestamp( void )
   }
 
   // NB: mach_absolute_time() returns "absolute time units"
-  // We need to apply a conversion to get milliseconds.
-  millis_cache = ((mach_absolute_time() * s_timebase_info.numer) / (1000000 * s_timebase_info.denom));
-  return;								    
+  // We need to apply a conversion to get microseconds.
+  return ((mach_absolute_time() * s_timebase_info.numer) / (1000 * s_timebase_info.denom));
 #elif HAVE_GETTIMEOFDAY
   // NOTE: If time steps backwards, timeouts may be confused.
   struct timeval tv;
   if ( gettimeofday(&tv, NULL) ) {
     perror( "gettimeofday" );
   } else {
-    uint64_t millis = tv.tv_usec / 1000;
-    millis += uint64_t( tv.tv_sec ) * 1000;
+    uint64_t micros = tv.tv_usec;
+    micros += uint64_t( tv.tv_sec ) * 1000000;
 
-    millis_cache = millis;
-    return;
+    return micros;
   }
 #else
 # error "Don't know how to get a timestamp on this platform"
 #endif
+
+  return micros_cache;
+}
+
+#if HAVE_TSC
+/* The TSC is scaled by the rate seen since the first reading, which
+   grows more accurate as the baseline lengthens. Until 100 ms have
+   passed, and whenever a second has passed since the last anchor,
+   the system clock is read instead. */
+static const uint64_t TSC_CALIBRATION_US = 100000;
+static const uint64_t TSC_ANCHOR_US = 1000000;
+
+static int tsc_state = -1; /* unchecked, off, on */
+static uint64_t tsc_first = 0, tsc_first_us = 0;
+static uint64_t tsc_anchor = 0, tsc_anchor_us = 0;
+static uint64_t tsc_anchor_ticks = 0; /* TSC_ANCHOR_US in ticks */
+static double tsc_us_per_tick = 0;
+
+static bool tsc_invariant( void )
+{
+  unsigned int eax, ebx, ecx, edx;
+  if ( !__get_cpuid( 0x80000000, &eax, &ebx, &ecx, &edx ) || eax < 0x80000007 ) {
+    return false;
+  }
+  __get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx );
+  return edx & ( 1 << 8 );
+}
+
+static uint64_t tsc_clock_us( void )
+{
+  const uint64_t tsc = __rdtsc();
+
+  if ( tsc_us_per_tick > 0 && tsc - tsc_anchor < tsc_anchor_ticks ) {
+    return tsc_anchor_us + uint64_t( ( tsc - tsc_anchor ) * tsc_us_per_tick );
+  }
+
+  const uint64_t now = system_clock_us();
+
+  if ( tsc_first_us == 0 ) {
+    tsc_first = tsc;
+    tsc_first_us = now;
+  } else if ( now - tsc_first_us >= TSC_CALIBRATION_US && tsc > tsc_first ) {
+    tsc_us_per_tick = double( now - tsc_first_us ) / double( tsc - tsc_first );
+    tsc_anchor = tsc;
+    tsc_anchor_us = now;
+    tsc_anchor_ticks = TSC_ANCHOR_US / tsc_us_per_tick;
+  }
+
+  return now;
+}
+#endif
+
+bool timestamp_use_tsc( const bool use )
+{
+#if HAVE_TSC
+  tsc_state = use && tsc_invariant();
+  return tsc_state;
+#else
+  (void)use;
+  return false;
+#endif
+}
+
+static uint64_t read_clock_us( void )
+{
+#if HAVE_TSC
+  if ( tsc_state < 0 ) {
+    timestamp_use_tsc( true );
+  }
+  if ( tsc_state > 0 ) {
+    return tsc_clock_us();
+  }
+#endif
+  return system_clock_us();
 }
@@ -35,7 +35,36 @@
 
 #include <stdint.h>
 
+/* Monotonic time, read once by freeze_timestamp() (e.g. after each
+   select) and then served from the cache. Both clocks share an epoch:
+   frozen_timestamp_us() / 1000 == frozen_timestamp(). */
 void freeze_timestamp( void );
-uint64_t frozen_timestamp( void );
+uint64_t frozen_timestamp( void ); /* ms */
+uint64_t frozen_timestamp_us( void ); /* us */
+
+/* Where an x86 TSC runs at a constant rate, the clock is read from it,
+   scaled against CLOCK_MONOTONIC and re-anchored to it every second;
+   otherwise every read is a clock_gettime(). Returns whether the TSC
+   is in use after the call. */
+bool timestamp_use_tsc( const bool use );
+
+/* How old the frozen time was when used. Tracking reads the clock at
+   every use, as does a limit, past which the time is frozen afresh
+   (0 for none). */
+class TimestampStaleness
+{
+public:
+  uint64_t uses;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t refreezes; /* uses that went over the limit */
+
+  TimestampStaleness() : uses( 0 ), total_us( 0 ), max_us( 0 ), refreezes( 0 ) {}
+};
+
+void timestamp_track_staleness( const bool track );
+void timestamp_limit_staleness( const uint64_t max_us );
+const TimestampStaleness & timestamp_staleness( void );
+void timestamp_reset_staleness( void );
 
 #endif